@@ -0,0 +1,221 @@
+#pragma once
+
+#include "block.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+
+// Vector that keeps up to `inline_capacity` elements in place, and only
+// goes to the heap when it outgrows them.
+template <typename type, std::size_t inline_capacity>
+    requires std::is_trivially_copyable_v<type>
+class small_vector {
+public:
+    small_vector():
+        size_(0),
+        capacity_(inline_capacity) {
+    }
+
+    small_vector(const small_vector &other): small_vector() {
+        for (const type &element: other)
+            push_back(element);
+    }
+
+    small_vector(small_vector &&other) noexcept: small_vector() {
+        take(other);
+    }
+
+    small_vector &operator=(const small_vector &other) = delete;
+
+    small_vector &operator=(small_vector &&other) noexcept {
+        if (this != &other) {
+            release();
+            take(other);
+        }
+
+        return *this;
+    }
+
+    ~small_vector() {
+        release();
+    }
+
+    void push_back(type element) {
+        if (size_ == capacity_)
+            grow();
+
+        data()[size_ ++] = element;
+    }
+
+    type *data() { return is_spilled() ? heap_ : inline_; }
+    const type *data() const { return is_spilled() ? heap_ : inline_; }
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    type &operator[](std::size_t index) { assert(index < size_); return data()[index]; }
+    const type &operator[](std::size_t index) const { assert(index < size_); return data()[index]; }
+
+    type *begin() { return data(); }
+    type *end() { return data() + size_; }
+
+    const type *begin() const { return data(); }
+    const type *end() const { return data() + size_; }
+
+private:
+    uint32_t size_;
+    uint32_t capacity_;
+
+    union {
+        type inline_[inline_capacity];
+        type *heap_;
+    };
+
+    bool is_spilled() const { return capacity_ > inline_capacity; }
+
+    void release() {
+        if (is_spilled())
+            delete[] heap_;
+
+        size_ = 0;
+        capacity_ = inline_capacity;
+    }
+
+    // Moves elements out of the other vector, leaving it empty
+    void take(small_vector &other) {
+        size_ = other.size_;
+        capacity_ = other.capacity_;
+
+        if (other.is_spilled())
+            heap_ = other.heap_;
+        else
+            memcpy(inline_, other.inline_, size_ * sizeof(type));
+
+        other.size_ = 0;
+        other.capacity_ = inline_capacity;
+    }
+
+    void grow() {
+        type *grown = new type[capacity_ * 2];
+        memcpy(grown, data(), size_ * sizeof(type));
+
+        if (is_spilled())
+            delete[] heap_;
+
+        heap_ = grown;
+        capacity_ *= 2;
+    }
+};
+
+
+// Expected number of attempts needed to sign blocks. Single block with
+// MAX_PROOF_ORDER already takes all of 64 bits, so sums need more:
+using chain_work = unsigned __int128;
+
+inline chain_work calculate_work(const block &the_block) {
+    return chain_work(1) << the_block.proof_order;
+}
+
+
+using arranged_block_index = std::size_t;
+
+// Tree of all linked blocks. Every field is kept in its own array, so that
+// walks over the tree (which mostly need parents and heights) don't drag
+// whole headers through the cache. Besides its parent, every block links
+// to an ancestor further down (like in Bitcoin Core), so that ancestors
+// at any height are found in O(log n) jumps.
+class block_index {
+public:
+    // Adds the initial block, which is its own parent
+    arranged_block_index add(const hashed_block &the_block) {
+        assert(size() == 0);
+        return append(the_block, 0, 0, 0, calculate_work(the_block.data()));
+    }
+
+    arranged_block_index add(const hashed_block &the_block, arranged_block_index parent) {
+        assert(parent < size());
+
+        uint64_t height = heights_[parent] + 1;
+        arranged_block_index index = append(the_block, parent, ancestor(parent, get_skip_height(height)),
+                                            height, works_[parent] + calculate_work(the_block.data()));
+        successors_[parent].push_back(index);
+
+        return index;
+    }
+
+    std::size_t size() const { return hashes_.size(); }
+
+    const hash256_t &hash(arranged_block_index index) const { return hashes_[index]; }
+    const block &data(arranged_block_index index) const { return blocks_[index]; }
+
+    arranged_block_index parent(arranged_block_index index) const { return parents_[index]; }
+
+    // Number of blocks between this one and the initial block
+    uint64_t height(arranged_block_index index) const { return heights_[index]; }
+
+    // Ancestor of the block (or block itself) at the given height, which
+    // shouldn't be above the block's one
+    arranged_block_index ancestor(arranged_block_index index, uint64_t height) const {
+        assert(height <= heights_[index]);
+
+        while (heights_[index] != height) {
+            // Skip is taken, unless it overshoots, and parent's skip wouldn't be better
+            uint64_t skip_height = heights_[skips_[index]];
+            uint64_t parent_skip_height = get_skip_height(heights_[index] - 1);
+
+            bool is_skip_better = skip_height == height
+                || (skip_height > height && !(parent_skip_height + 2 < skip_height && parent_skip_height >= height));
+
+            index = is_skip_better ? skips_[index] : parents_[index];
+        }
+
+        return index;
+    }
+
+    // Work done to sign this block and all of its ancestors
+    chain_work work(arranged_block_index index) const { return works_[index]; }
+
+    // Most blocks have one successor at most, they are stored inline
+    using successor_list = small_vector<arranged_block_index, 1>;
+    const successor_list &successors(arranged_block_index index) const { return successors_[index]; }
+
+private:
+    std::vector<hash256_t> hashes_;
+    std::vector<arranged_block_index> parents_;
+    std::vector<arranged_block_index> skips_;
+    std::vector<uint64_t> heights_;
+    std::vector<chain_work> works_;
+    std::vector<successor_list> successors_;
+
+    std::vector<block> blocks_;
+
+    // Lowers height, so that skips of blocks close to each other mostly
+    // land far apart, but never below the height with the lowest set bit
+    // cleared, so that no skip overshoots by a lot
+    static uint64_t get_skip_height(uint64_t height) {
+        if (height < 2)
+            return 0;
+
+        auto clear_lowest_bit = [](uint64_t value) { return value & (value - 1); };
+        return height & 1 ? clear_lowest_bit(clear_lowest_bit(height - 1)) + 1 : clear_lowest_bit(height);
+    }
+
+    arranged_block_index append(const hashed_block &the_block, arranged_block_index parent,
+                                arranged_block_index skip, uint64_t height, chain_work work) {
+
+        hashes_.push_back(the_block.hash());
+        parents_.push_back(parent);
+        skips_.push_back(skip);
+        heights_.push_back(height);
+        works_.push_back(work);
+        successors_.emplace_back();
+        blocks_.push_back(the_block.data());
+
+        return size() - 1;
+    }
+};
@@ -0,0 +1,280 @@
+#include "block-store.h"
+
+#include <algorithm>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+constexpr uint32_t STORE_MAGIC = 'B'*256*256*256 + 'S'*256*256 + 'T'*256 + 'R';
+constexpr uint32_t STORE_VERSION = BLOCK_VERSION;
+
+constexpr uint64_t SEGMENT_SIZE = block_store::SEGMENT_BLOCKS * sizeof(block);
+
+// Index grows by doubling, starting with this many entries:
+constexpr uint64_t INITIAL_INDEX_CAPACITY = 4096;
+
+}
+
+block_store::block_store():
+    directory_(),
+    index_fd_(-1),
+    index_(nullptr),
+    index_capacity_(0),
+    segment_fd_(-1),
+    segment_number_(0) {
+}
+
+block_store::~block_store() {
+    close();
+}
+
+std::string block_store::segment_path(uint64_t segment) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/segment-%05llu", (unsigned long long) segment);
+
+    return directory_ + name;
+}
+
+size_t block_store::index_size(uint64_t capacity) {
+    return sizeof(index_header) + capacity * sizeof(index_entry);
+}
+
+bool block_store::map_index(uint64_t capacity) {
+    size_t size = index_size(capacity);
+
+    if (ftruncate(index_fd_, size) < 0) {
+        perror("ftruncate");
+        return false;
+    }
+
+    void* mapped = index_ == nullptr
+        ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, index_fd_, 0)
+        : mremap(index_, index_size(index_capacity_), size, MREMAP_MAYMOVE);
+
+    if (mapped == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+
+    index_ = (index_file*) mapped;
+    index_capacity_ = capacity;
+
+    return true;
+}
+
+bool block_store::open(const char* directory) {
+    close();
+
+    if (mkdir(directory, 0755) < 0 && errno != EEXIST) {
+        perror("mkdir");
+        return false;
+    }
+
+    directory_ = directory;
+
+    std::string index_path = directory_ + "/index";
+    index_fd_ = ::open(index_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (index_fd_ < 0) {
+        perror("open");
+        return false;
+    }
+
+    struct stat index_stat;
+    if (fstat(index_fd_, &index_stat) < 0) {
+        perror("fstat");
+        close();
+
+        return false;
+    }
+
+    bool is_new = index_stat.st_size == 0;
+
+    uint64_t capacity = INITIAL_INDEX_CAPACITY;
+    if (!is_new) {
+        if ((size_t) index_stat.st_size < sizeof(index_header)) {
+            fprintf(stderr, "block store: index is truncated: %s\n", index_path.c_str());
+            close();
+
+            return false;
+        }
+
+        capacity = std::max<uint64_t>((index_stat.st_size - sizeof(index_header)) / sizeof(index_entry),
+                                      INITIAL_INDEX_CAPACITY);
+    }
+
+    if (!map_index(capacity)) {
+        close();
+        return false;
+    }
+
+    if (is_new)
+        index_->header = { .magic = STORE_MAGIC, .version = STORE_VERSION, .size = 0 };
+
+    if (index_->header.magic != STORE_MAGIC || index_->header.version != STORE_VERSION
+        || index_->header.size > index_capacity_) {
+
+        fprintf(stderr, "block store: index is corrupted: %s\n", index_path.c_str());
+        close();
+
+        return false;
+    }
+
+    if (!check_last_segment()) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+// Index entry gets written after the block itself, but a crash of the system
+// could still lose the block, if it wasn't flushed. Forget such blocks:
+bool block_store::check_last_segment() {
+    while (index_->header.size > 0) {
+        uint64_t offset = index_->entries[index_->header.size - 1].offset;
+
+        uint64_t stored = 0;
+
+        struct stat segment_stat;
+        if (stat(segment_path(offset / SEGMENT_SIZE).c_str(), &segment_stat) == 0)
+            stored = segment_stat.st_size;
+        else if (errno != ENOENT) {
+            perror("stat");
+            return false;
+        }
+
+        if (offset % SEGMENT_SIZE + sizeof(block) <= stored)
+            break;
+
+        -- index_->header.size;
+    }
+
+    return true;
+}
+
+void block_store::close() {
+    if (segment_fd_ >= 0)
+        ::close(segment_fd_);
+
+    if (index_ != nullptr)
+        munmap(index_, index_size(index_capacity_));
+
+    if (index_fd_ >= 0)
+        ::close(index_fd_);
+
+    index_fd_ = -1;
+    index_ = nullptr;
+    index_capacity_ = 0;
+
+    segment_fd_ = -1;
+    segment_number_ = 0;
+}
+
+uint64_t block_store::size() const {
+    return index_ ? index_->header.size : 0;
+}
+
+bool block_store::open_segment(uint64_t segment) {
+    if (segment_fd_ >= 0 && segment_number_ == segment)
+        return true;
+
+    if (segment_fd_ >= 0)
+        ::close(segment_fd_);
+
+    segment_fd_ = ::open(segment_path(segment).c_str(), O_RDWR | O_CREAT, 0644);
+    if (segment_fd_ < 0) {
+        perror("open");
+        return false;
+    }
+
+    segment_number_ = segment;
+    return true;
+}
+
+bool block_store::append(const block &the_block, const hash256_t &hash) {
+    if (!is_open())
+        return false;
+
+    uint64_t position = index_->header.size;
+    uint64_t offset = position * sizeof(block);
+
+    if (!open_segment(offset / SEGMENT_SIZE))
+        return false;
+
+    if (pwrite(segment_fd_, &the_block, sizeof(block), offset % SEGMENT_SIZE) != sizeof(block)) {
+        perror("pwrite");
+        return false;
+    }
+
+    if (position == index_capacity_ && !map_index(index_capacity_ * 2))
+        return false;
+
+    index_->entries[position] = { .hash = hash, .offset = offset };
+
+    // Block becomes visible only after its entry is complete:
+    __atomic_store_n(&index_->header.size, position + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool block_store::load(const std::function<void (const block&, const hash256_t&)> &callback) {
+    if (!is_open())
+        return false;
+
+    const uint64_t size = index_->header.size;
+
+    // Segments are mapped one at a time and walked front to back:
+    for (uint64_t position = 0; position < size; ) {
+        uint64_t segment = index_->entries[position].offset / SEGMENT_SIZE;
+
+        int fd = ::open(segment_path(segment).c_str(), O_RDONLY);
+        if (fd < 0) {
+            perror("open");
+            return false;
+        }
+
+        struct stat segment_stat;
+        if (fstat(fd, &segment_stat) < 0) {
+            perror("fstat");
+            ::close(fd);
+
+            return false;
+        }
+
+        void* mapped = mmap(nullptr, segment_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+
+        if (mapped == MAP_FAILED) {
+            perror("mmap");
+            return false;
+        }
+
+        madvise(mapped, segment_stat.st_size, MADV_SEQUENTIAL);
+
+        for (; position < size && index_->entries[position].offset / SEGMENT_SIZE == segment; ++ position) {
+            const index_entry &entry = index_->entries[position];
+            if (entry.offset % SEGMENT_SIZE + sizeof(block) > (uint64_t) segment_stat.st_size) {
+                fprintf(stderr, "block store: segment %llu is truncated\n", (unsigned long long) segment);
+                munmap(mapped, segment_stat.st_size);
+
+                return false;
+            }
+
+            block stored;
+            memcpy(&stored, (const char*) mapped + entry.offset % SEGMENT_SIZE, sizeof(block));
+
+            callback(stored, entry.hash);
+        }
+
+        munmap(mapped, segment_stat.st_size);
+    }
+
+    return true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "block.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+
+// Blocks linked into the chain, kept on disk in the order they were linked,
+// so that parents always come before their children. Blocks are appended to
+// segment files of SEGMENT_BLOCKS each, and an index file maps every one of
+// them (by its hash) to the offset it's stored at. The index is memory
+// mapped, so reopening the store involves neither reading it, nor hashing.
+//
+// Nothing is synced to disk explicitly: store survives crashes of the node,
+// and blocks lost in a crash of the system are just received once again.
+class block_store {
+public:
+    static constexpr uint64_t SEGMENT_BLOCKS = 1 << 16;
+
+    block_store();
+    ~block_store();
+
+    block_store(const block_store &other) = delete;
+    block_store& operator=(const block_store &other) = delete;
+
+    // Opens store in `directory`, which is created if needed. Returns
+    // false if it couldn't be opened, the store stays closed then.
+    bool open(const char* directory);
+    void close();
+
+    bool is_open() const { return index_ != nullptr; }
+
+    // Number of blocks in the store
+    uint64_t size() const;
+
+    bool append(const block &the_block, const hash256_t &hash);
+
+    // Calls `callback` on every block in the order they were appended.
+    // Returns false if some of the segments couldn't be read.
+    bool load(const std::function<void (const block&, const hash256_t&)> &callback);
+
+private:
+    struct index_header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t size;
+    };
+
+    struct index_entry {
+        hash256_t hash;
+        uint64_t offset; // Counted over all segments, as if they were one file
+    };
+
+    struct index_file {
+        index_header header;
+        index_entry entries[];
+    };
+
+    std::string directory_;
+
+    int index_fd_;
+    index_file* index_;
+    uint64_t index_capacity_; // In entries
+
+    int segment_fd_;
+    uint64_t segment_number_;
+
+    static size_t index_size(uint64_t capacity);
+
+    std::string segment_path(uint64_t segment) const;
+    bool map_index(uint64_t capacity);
+    bool open_segment(uint64_t segment);
+    bool check_last_segment();
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include "crypto.h"
+
+#include <array>
+#include <cassert>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <optional>
+#include <string_view>
+
+// == ACTION
+
+struct action {
+    char vote;
+};
+
+struct block_data {
+    char votes[32 - 8];
+    uint8_t count_votes;
+
+    void act(action action) {
+        assert(!is_full());
+        votes[count_votes ++] = action.vote;
+    }
+
+    bool is_full() {
+        return count_votes == 3;
+    }
+};
+
+// =========
+
+
+constexpr uint32_t BLOCK_MAGIC = 'P'*256*256*256 + 'F'*256*256 + 'N'*256 + 'S';
+
+// Difficulty is the number of low zero bits required in the block hash,
+// it's stored in every block and retargeted by the chain over time.
+constexpr uint32_t PROOF_ORDER     = 22; // Initial one, used by the first block
+constexpr uint32_t MIN_PROOF_ORDER = 16; // Less work than this is never accepted
+constexpr uint32_t MAX_PROOF_ORDER = 64;
+
+
+using hash256_t = std::array<uint32_t, 8>;
+
+static_assert(sizeof(hash256_t) == HASH_SIZE * sizeof(uint32_t),
+              "Arrays of hashes are passed to batch hashing as is");
+
+namespace std {
+    template <>
+    struct hash<hash256_t> {
+        // Hashes are uniformly distributed already, except for the leading
+        // words, which are mostly zeros for signed blocks:
+        size_t operator()(const hash256_t& key) const noexcept {
+            return (uint64_t(key[7]) << 32) | key[6];
+        }
+    };
+}
+
+template <>
+struct std::formatter<hash256_t>: std::formatter<uint32_t> {
+    auto format(const hash256_t& hash, std::format_context& ctx) const {
+        auto out = ctx.out();
+        for (size_t i = 0; i < hash.size(); ++i)
+            std::format_to(ctx.out(), "{:08X}", hash[i]);
+        return out;
+    }
+};
+
+// Reads hash back from the form it's formatted in
+inline std::optional<hash256_t> parse_hash(std::string_view text) {
+    hash256_t hash {};
+    if (text.size() != hash.size() * 8)
+        return std::nullopt;
+
+    for (size_t i = 0; i < hash.size(); ++i) {
+        const char *first = text.data() + i * 8, *last = first + 8;
+
+        auto [end, error] = std::from_chars(first, last, hash[i], 16);
+        if (error != std::errc() || end != last)
+            return std::nullopt;
+    }
+
+    return hash;
+}
+
+
+// Version of block layout, it's hashed and sent over the network as is
+constexpr uint32_t BLOCK_VERSION = 1;
+
+struct block {
+    // == Prefix, stays the same while block is being signed. It spans exactly
+    //    one SHA-256 message block, which is compressed once per candidate.
+    uint32_t version;
+    hash256_t previous_hash;
+
+    block_data data;
+    uint8_t reserved[3]; // Explicit padding, so that hashed bytes are defined
+
+    // == Suffix, changes with every signing attempt, lands in the last
+    //    message block, together with the padding.
+    uint32_t pow_signature;
+
+    // Rolled over each time all values of pow_signature are tried, so that
+    // search can go on even at difficulties that need more than 2^32 attempts
+    uint32_t pow_extra_signature;
+
+    uint64_t timestamp; // Milliseconds since epoch, when block was assembled
+
+    uint32_t proof_order;
+    uint8_t reserved_suffix[4];
+
+    constexpr hash256_t calculate_hash() const {
+        hash256_t hash {};
+        hash_with_sha_256(*this, hash.data());
+
+        return hash;
+    }
+
+    // Hash state after the prefix, same for all signing attempts
+    hash256_t calculate_midstate() const {
+        hash256_t midstate;
+        start_sha_256<1>(this, midstate.data());
+
+        return midstate;
+    }
+
+    hash256_t calculate_hash(const hash256_t &midstate) const {
+        hash256_t hash = midstate;
+        finish_sha_256<sizeof(block), 1>(this, hash.data());
+
+        return hash;
+    }
+
+    static constexpr bool is_signed_hash(const hash256_t &hash, uint32_t proof_order) {
+        for (uint32_t word: hash) {
+            if (proof_order < 32) {
+                uint32_t mask = (1u << proof_order) - 1;
+                return (word & mask) == 0;
+            }
+
+            if (word != 0)
+                return false;
+
+            proof_order -= 32;
+        }
+
+        return true;
+    }
+
+    // Same as verify(), for when hash of the block is already known
+    constexpr bool verify(const hash256_t &hash) const {
+        return version == BLOCK_VERSION
+            && proof_order >= MIN_PROOF_ORDER && proof_order <= MAX_PROOF_ORDER
+            && is_signed_hash(hash, proof_order);
+    }
+
+    constexpr bool verify() const {
+        return verify(calculate_hash());
+    }
+};
+
+static_assert(offsetof(block, pow_signature) == SHA_256_BLOCK_SIZE,
+              "Signature should be the only thing outside of the hash prefix");
+
+static_assert(sizeof(block) == SHA_256_FIXED_BATCH_SIZE,
+              "Received blocks are batch hashed with precomputed padding");
+
+
+// Block together with its hash. Hash is computed once, when block enters the
+// node (it's received, signed or loaded), and is carried everywhere after.
+class hashed_block {
+public:
+    explicit constexpr hashed_block(const block &the_block):
+        block_(the_block),
+        hash_(the_block.calculate_hash()) {
+    }
+
+    // For when hash is known already, e.g. it was computed in a batch
+    constexpr hashed_block(const block &the_block, const hash256_t &hash):
+        block_(the_block),
+        hash_(hash) {
+    }
+
+    constexpr const block &data() const { return block_; }
+    constexpr const hash256_t &hash() const { return hash_; }
+
+    constexpr bool verify() const { return block_.verify(hash_); }
+
+private:
+    block block_;
+    hash256_t hash_;
+};
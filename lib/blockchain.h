@@ -1,9 +1,18 @@
 #pragma once
 
-#include "crypto.h"
+#include "block.h"
+#include "block-index.h"
+#include "block-store.h"
+#include "genesis.h"
+#include "hash-map.h"
 #include "broadcast.h"
+#include "event-loop.h"
+#include "miner.h"
+#include "orphan-pool.h"
+#include "worker-pool.h"
 
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <deque>
 #include <fstream>
@@ -11,90 +20,21 @@
 #include <optional>
 #include <thread>
 #include <vector>
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <unordered_map>
 #include <cassert>
 
 #define LOG_ID node_id_
 #include "log.h"
 
-// == ACTION
-
-struct action {
-    char vote;
-};
-
-struct block_data {
-    char votes[32 - 8];
-    uint8_t count_votes;
-
-    void act(action action) {
-        assert(!is_full());
-        votes[count_votes ++] = action.vote;
-    }
-
-    bool is_full() {
-        return count_votes == 3;
-    }
-};
-
-// =========
-
-
-constexpr uint32_t BLOCK_MAGIC = 'P'*256*256*256 + 'F'*256*256 + 'N'*256 + 'S';
-constexpr uint32_t PROOF_ORDER = 22;
-
-
-using hash256_t = std::array<uint32_t, 8>;
-
-namespace std {
-    template <>
-    struct hash<hash256_t> {
-        size_t operator()(const hash256_t& key) const noexcept {
-            size_t result = 0;
-            for (const auto& value : key)
-                result ^= std::hash<uint32_t>{}(value);
-
-            return result;
-        }
-    };
-}
-
-template <>
-struct std::formatter<hash256_t>: std::formatter<uint32_t> {
-    auto format(const hash256_t& hash, std::format_context& ctx) const {
-        auto out = ctx.out();
-        for (size_t i = 0; i < hash.size(); ++i)
-            std::format_to(ctx.out(), "{:08X}", hash[i]);
-        return out;
-    }
-};
-
-
-struct block {
-    uint32_t pow_signature;
-    hash256_t previous_hash;
-
-    block_data data;
-
-    hash256_t calculate_hash() const {
-        hash256_t hash;
-        hash_with_sha_256(this, sizeof(block), hash.data());
-
-        return hash;
-    }
-
-    bool verify() const {
-        uint32_t mask = (1 << PROOF_ORDER) - 1;
-        return (calculate_hash()[0] & mask) == 0;
-    }
-};
-
 enum class transaction_type: uint16_t {
-    DISCOVER      = 0b00,
-    SYNC          = 0b01,
-    NOTIFY_SIGNED = 0b10,
-    ACT           = 0b11
+    DISCOVER      = 0b000,
+    SYNC          = 0b001,
+    NOTIFY_SIGNED = 0b010,
+    ACT           = 0b011,
+    GET_BLOCKS    = 0b100
 };
 
 
@@ -104,11 +44,24 @@ inline const char* get_transaction_name(transaction_type type) {
     case transaction_type::SYNC:          return "SYNC";
     case transaction_type::NOTIFY_SIGNED: return "NOTIFY_SIGNED";
     case transaction_type::ACT:           return "ACT";
+    case transaction_type::GET_BLOCKS:    return "GET_BLOCKS";
     default: assert(false && "Unhandeled transaction type");
     }
 }
 
 
+// Hashes of blocks on requester's chain, from the block it has synced up
+// to down: the latest ones, then exponentially sparser, and the genesis
+// block last. The first of them, that's on responder's best chain too, is
+// where the chains fork.
+constexpr size_t MAX_LOCATOR_HASHES = 32;
+
+struct block_locator {
+    uint32_t count;
+    hash256_t hashes[MAX_LOCATOR_HASHES];
+};
+
+
 struct transaction {
     uint32_t magic = BLOCK_MAGIC;
     uint16_t channel;
@@ -118,42 +71,75 @@ struct transaction {
     union {
         block signed_block;
         action act;
+        block_locator locator;
     };
 };
 
+constexpr size_t TRANSACTION_HEADER_SIZE = offsetof(transaction, signed_block);
 
-using arranged_block_index = std::size_t;
+// Only the part of transaction that's used by its type gets sent
+inline size_t get_transaction_size(const transaction &message) {
+    switch (message.type) {
+    case transaction_type::DISCOVER:      return TRANSACTION_HEADER_SIZE;
+    case transaction_type::SYNC:          return TRANSACTION_HEADER_SIZE + sizeof(block);
+    case transaction_type::NOTIFY_SIGNED: return TRANSACTION_HEADER_SIZE + sizeof(block);
+    case transaction_type::ACT:           return TRANSACTION_HEADER_SIZE + sizeof(action);
 
-// Proxy used to quickly access blocks
-class arranged_block {
-public:
-    arranged_block(const block &the_block):
-        the_block_(the_block),
-        hash_(the_block.calculate_hash()),
-        next_() { // List is empty for newly created blocks
-    }
+    case transaction_type::GET_BLOCKS:
+        return TRANSACTION_HEADER_SIZE + offsetof(block_locator, hashes)
+             + uint64_t(message.locator.count) * sizeof(hash256_t);
 
-    void add_successor(arranged_block_index successor) {
-        next_.emplace_back(successor);
+    default: return 0; // Never matches, so it's discarded
     }
+}
 
-    const hash256_t &hash() { return hash_; }
-    block &data() { return the_block_; }
 
-    const std::vector<arranged_block_index> &successors() { return next_; }
-    std::size_t size() { return next_.size(); }
+// Difficulty is recalculated every RETARGET_WINDOW blocks, so that blocks
+// get signed once per TARGET_BLOCK_INTERVAL on average, whatever the
+// mining capacity is. Single retarget changes it at most MAX_RETARGET_STEP.
+constexpr uint64_t RETARGET_WINDOW = 16;
+constexpr std::chrono::milliseconds TARGET_BLOCK_INTERVAL{10000};
+constexpr int MAX_RETARGET_STEP = 2;
 
-private:
-    block the_block_;
-    hash256_t hash_;
+// Blocks with timestamps further ahead of local time are rejected, as
+// are ones that aren't later than their parent
+constexpr std::chrono::milliseconds MAX_CLOCK_DRIFT{2 * 60 * 60 * 1000};
 
-    // TODO: this could really be a small vector
-    std::vector<arranged_block_index> next_;
-};
+// Status is logged, orphans evicted and act file checked this often.
+// Everything else happens as soon as the event it waits for comes.
+constexpr std::chrono::milliseconds TICK_INTERVAL{1000};
+
+// While this file exists, its first character is voted for every tick
+constexpr const char* ACT_FILE = "act";
+
+// Missing blocks are requested from a single peer, which sends this many
+// at most in response to every request. They go up from the fork point,
+// so that each of them links right away, and none has to wait in orphans.
+constexpr uint64_t MAX_SYNC_BLOCKS = 128;
+
+// Blocks staged below a checkpoint that isn't reached yet are validated as
+// usual, rather than staged any further, once there's this many of them
+constexpr size_t MAX_ASSUMED_BLOCKS = 1 << 18;
+
+// Sync peer that sent nothing for this long gets asked for more, or given up on
+constexpr std::chrono::seconds SYNC_TIMEOUT{3};
 
+// Transactions are received this many at a time
+constexpr size_t TRANSACTION_BATCH = 64;
 
+// Orphans wait for their parents at most this long, and this many of them
+constexpr size_t MAX_ORPHANS = 1 << 18;
+constexpr std::chrono::minutes MAX_ORPHAN_AGE{10};
+
+inline uint64_t current_timestamp() {
+    auto since_epoch = std::chrono::system_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(since_epoch).count();
+}
+
+
+// Proxy used to quickly access blocks
 struct arranged_block_iterable_proxy {
-    arranged_block_iterable_proxy(std::vector<arranged_block> &blocks, arranged_block_index current_index):
+    arranged_block_iterable_proxy(block_index &blocks, arranged_block_index current_index):
         blocks_(&blocks),
         current_index_(current_index) {
 
@@ -161,84 +147,106 @@ struct arranged_block_iterable_proxy {
 
     class iterator {
     public:
-        iterator(std::vector<arranged_block> &blocks, arranged_block_index parent, int successor_index):
+        iterator(block_index &blocks, const arranged_block_index *successor):
             blocks_(blocks),
-            parent_(parent),
-            successor_index_(successor_index) {}
+            successor_(successor) {}
 
-        iterator operator++() {
-            return {blocks_, parent_, successor_index_ + 1};
+        iterator &operator++() {
+            ++ successor_;
+            return *this;
         }
 
         arranged_block_iterable_proxy operator*() {
-            assert(blocks_[parent_].successors().size() > successor_index_);
-            return {blocks_, blocks_[parent_].successors()[successor_index_]};
+            return {blocks_, *successor_};
         }
 
-        auto operator<=>(const iterator &other) const {
-            assert(parent_ == other.parent_);
+        bool operator==(const iterator &other) const {
             assert(&blocks_ == &other.blocks_);
-            return successor_index_ <=> other.successor_index_;
+            return successor_ == other.successor_;
         }
 
-        bool operator==(const iterator &other) const { return ((*this) <=> other) == 0; };
-        bool operator!=(const iterator &other) const { return ((*this) <=> other) != 0; };
-        bool operator< (const iterator &other) const { return ((*this) <=> other) <  0; };
-        bool operator> (const iterator &other) const { return ((*this) <=> other) >  0; };
-        bool operator>=(const iterator &other) const { return ((*this) <=> other) >= 0; };
-        bool operator<=(const iterator &other) const { return ((*this) <=> other) <= 0; };
-
     private:
-        std::vector<arranged_block> &blocks_;
-        arranged_block_index parent_;
-        int successor_index_;
+        block_index &blocks_;
+        const arranged_block_index *successor_;
     };
 
-    iterator begin() { return {*blocks_, current_index_, 0}; }
-    iterator   end() { return {*blocks_, current_index_, static_cast<int>(unproxy().size() - 1)}; }
-
-    arranged_block &unproxy() { return (*blocks_)[current_index_]; }
+    iterator begin() { return {*blocks_, blocks_->successors(current_index_).begin()}; }
+    iterator   end() { return {*blocks_, blocks_->successors(current_index_).end()}; }
 
-    decltype(auto) hash() { return unproxy().hash();  }
-    decltype(auto) data() { return unproxy().data(); }
-    decltype(auto) size() { return unproxy().size(); }
+    decltype(auto) hash() { return blocks_->hash(current_index_); }
+    decltype(auto) data() { return blocks_->data(current_index_); }
+    decltype(auto) size() { return blocks_->successors(current_index_).size(); }
 
     arranged_block_index index() { return current_index_; }
 
 private:
+    block_index *blocks_;
     arranged_block_index current_index_;
-    std::vector<arranged_block> *blocks_;
 };
 
 
 template <typename network_type>
 class blockchain {
 public:
-    blockchain(int node_id, uint16_t channel, network_type &&net):
+    blockchain(int node_id, uint16_t channel, network_type &&net,
+               unsigned mining_threads = std::thread::hardware_concurrency(),
+               const char* storage_directory = nullptr):
         node_id_(node_id),
         net_(std::move(net)),
         channel_(channel),
+        miner_(mining_threads),
+        validators_(std::thread::hardware_concurrency()),
         arranged_blocks_(),
         block_registry_(),
-        pending_blocks_(),
+        best_tip_(initial_block_index),
+        vote_counts_(),
+        orphans_(MAX_ORPHANS, MAX_ORPHAN_AGE),
+        checkpoint_(),
+        assumed_(),
+        events_(),
+        tick_timer_fd_(-1),
+        act_watch_fd_(-1),
+        stop_fd_(-1),
+        should_stop_(false),
+        sync_peer_(),
+        sync_deadline_(),
+        sync_start_(initial_block_index),
+        sync_received_(0),
+        sync_last_(),
+        sync_requests_(0),
         current_sequence_number_(0) {
 
-        LOG("INIT: signing initial block - in progress");
+        // Genesis is checked at compile time, it doesn't need signing or hashing:
+        block_registry_.insert(GENESIS_HASH, arranged_blocks_.add(HASHED_GENESIS_BLOCK));
+        LOG("INIT: genesis block: {}", GENESIS_HASH);
 
-        arranged_blocks_.push_back(block {});
-        sign_block(arranged_blocks_.back().data());
-        block_registry_[arranged_blocks_.back().hash()] = arranged_blocks_.size() - 1;
+        if (storage_directory && !store_.open(storage_directory))
+            LOG("INIT: couldn't open block store in '{}', blocks won't be saved", storage_directory);
 
-        LOG("INIT: signing initial block - done: {}", arranged_blocks_.back().hash());
+        if (store_.size() > 0)
+            load_blocks();
+        else
+            store_block(HASHED_GENESIS_BLOCK);
 
         transaction sync {
             .channel = channel,
             .type = transaction_type::DISCOVER,
             .sequence_number = current_sequence_number_ ++,
+            .signed_block = {}
         };
         broadcast(sync);
 
         LOG("INIT: broadcasting DISCOVER");
+
+        events_.watch(net_.receive_fd(), (uint32_t) event_source::NETWORK);
+        events_.watch(miner_.completion_fd(), (uint32_t) event_source::MINER);
+
+        if (net_.address_change_fd() >= 0)
+            events_.watch(net_.address_change_fd(), (uint32_t) event_source::ADDRESS_CHANGE);
+
+        tick_timer_fd_ = events_.add_timer(TICK_INTERVAL, (uint32_t) event_source::TICK);
+        act_watch_fd_ = events_.add_directory_watch(".", (uint32_t) event_source::ACT_FILE);
+        stop_fd_ = events_.add_notifier((uint32_t) event_source::STOP);
     }
 
 private:
@@ -247,12 +255,69 @@ private:
     network_type net_;
     uint16_t channel_;
 
+    miner miner_;
+
+    // Hashes bursts of received blocks in parallel, on as many threads as
+    // there are cores, so miner is paused while they're busy
+    worker_pool validators_;
+    std::optional<pane_id> stats_pane_;
+
     static constexpr arranged_block_index initial_block_index = 0;
 
-    std::vector<arranged_block> arranged_blocks_;
-    std::unordered_map<hash256_t, arranged_block_index> block_registry_;
+    block_index arranged_blocks_;
+    hash256_map<arranged_block_index> block_registry_;
+
+    // Block with the most work behind it, updated as blocks get linked
+    arranged_block_index best_tip_;
+
+    // Every linked block is also appended here, if storage is enabled
+    block_store store_;
+
+    // Votes in all blocks on the way to best_tip_, moved along with it
+    std::array<uint64_t, 256> vote_counts_;
+
+    // Blocks, whose parents haven't been received yet
+    orphan_pool orphans_;
+
+    // Block that, together with its ancestors, is assumed to be valid,
+    // until it's linked. Sync peer's blocks are hashed as usual, and
+    // staged in a run going up from a linked block, each one the child of
+    // the one before. Once the run reaches the checkpoint, its hash vouches
+    // for all of them, and they're linked without checking their PoW,
+    // difficulty or timestamps. Runs that break, or miss it, are validated.
+    std::optional<hash256_t> checkpoint_;
+    std::vector<hashed_block> assumed_;
+
+    enum class event_source: uint32_t {
+        NETWORK,
+        MINER,
+        TICK,
+        ACT_FILE,
+        ADDRESS_CHANGE,
+        STOP
+    };
+
+    static constexpr size_t NUM_EVENT_SOURCES = 6;
+
+    event_loop events_;
+    int tick_timer_fd_;
+    int act_watch_fd_;
+
+    // Set by stop() from another thread, which then wakes the loop up
+    int stop_fd_;
+    std::atomic<bool> should_stop_;
+
+    // Peer we're receiving missing blocks from, one at a time
+    std::optional<address> sync_peer_;
+    std::chrono::steady_clock::time_point sync_deadline_;
+
+    // Block the last request was made from, blocks peer has sent since
+    // then, and the last (highest) of them, where the next request starts
+    arranged_block_index sync_start_;
+    uint64_t sync_received_;
+    block sync_last_;
 
-    std::vector<block> pending_blocks_;
+    uint64_t sync_requests_; // Made since the node started
 
     struct pending_block {
         block the_block;
@@ -267,70 +332,134 @@ private:
 
 
 
-    uint32_t random_pow_signature() {
-        return ((uint32_t) rand() << 16) | (uint32_t) rand();
+    bool is_block_duplicate(const hash256_t &hash) {
+        if (block_registry_.contains(hash))
+            return true;
+
+        return orphans_.contains(hash);
     }
 
-    bool sign_block(block &new_block, std::chrono::milliseconds timeout = std::numeric_limits<std::chrono::milliseconds>::max()) {
-        auto start = std::chrono::high_resolution_clock::now();
-        while (!try_signing_block(new_block)) {
-            auto now = std::chrono::high_resolution_clock::now();
-            std::chrono::duration<double> elapsed = start - now;
+    arranged_block_index find_ancestor(arranged_block_index index, uint64_t depth) {
+        return arranged_blocks_.ancestor(index, arranged_blocks_.height(index) - depth);
+    }
 
-            if (elapsed >= timeout)
-                return false;
-        }
+    // Difficulty every child of the given block should be signed with
+    uint32_t next_proof_order(arranged_block_index parent_index) {
+        const block &parent = arranged_blocks_.data(parent_index);
+        uint32_t parent_order = parent.proof_order;
 
-        return true;
+        uint64_t height = arranged_blocks_.height(parent_index) + 1;
+        if (height % RETARGET_WINDOW != 0)
+            return parent_order;
+
+        // Compare how long did it take to sign blocks in the window, to how long it should've:
+        const block &first = arranged_blocks_.data(find_ancestor(parent_index, RETARGET_WINDOW - 1));
+
+        int64_t expected = (RETARGET_WINDOW - 1) * TARGET_BLOCK_INTERVAL.count();
+        int64_t actual = std::max<int64_t>(parent.timestamp - first.timestamp, 1);
+
+        // Each order doubles amount of work, so step by the power of two:
+        int step = 0;
+        for (; step <  MAX_RETARGET_STEP && actual * 2 <= expected; ++ step) actual *= 2;
+        for (; step > -MAX_RETARGET_STEP && actual >= expected * 2; -- step) actual /= 2;
+
+        int64_t order = std::clamp<int64_t>(int64_t(parent_order) + step, MIN_PROOF_ORDER, MAX_PROOF_ORDER);
+        if (order != parent_order)
+            LOG("RETARGET: at height {} difficulty {} -> {}", height, parent_order, order);
+
+        return order;
     }
 
-    bool try_signing_block(block &new_block) {
-        assert(!new_block.verify());
+    // Puts already validated block into the tree, and moves the best tip to
+    // it, if there's more work behind it. On ties, tip seen first wins.
+    arranged_block_index link_block(const hashed_block &new_block, arranged_block_index parent) {
+        arranged_block_index index = arranged_blocks_.add(new_block, parent);
+        block_registry_.insert(new_block.hash(), index);
 
-        new_block.pow_signature = random_pow_signature();
-        bool is_verified = new_block.verify();
+        if (checkpoint_ == new_block.hash())
+            checkpoint_ = std::nullopt; // Whatever comes next is validated
 
-        if (is_verified)
-            LOG("SIGNING: successfully signed: {}", new_block.calculate_hash());
+        if (arranged_blocks_.work(index) > arranged_blocks_.work(best_tip_))
+            switch_tip(index);
 
-        return is_verified;
-    } 
+        return index;
+    }
 
-    bool is_block_duplicate(const block &block) {
-        if (block_registry_.find(block.calculate_hash()) != block_registry_.end())
-            return true;
+    void store_block(const hashed_block &new_block) {
+        if (store_.is_open() && !store_.append(new_block.data(), new_block.hash())) {
+            LOG("STORE: couldn't save {}, blocks won't be saved anymore", new_block.hash());
+            store_.close();
+        }
+    }
 
-        for (const auto &orphan: pending_blocks_)
-            if (orphan.calculate_hash() == block.calculate_hash())
-                return true;
+    // Blocks in the store were validated before they got there, and are
+    // stored in the order they were linked, so each of them just gets linked
+    // again, without even hashing it
+    void load_blocks() {
+        auto start = std::chrono::steady_clock::now();
 
-        return false;
+        bool is_loaded = store_.load([&](const block &stored, const hash256_t &hash) {
+            arranged_block_index *parent = block_registry_.find(stored.previous_hash);
+            if (parent && !block_registry_.contains(hash))
+                link_block({ stored, hash }, *parent);
+        });
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        LOG("INIT: loaded {} blocks in {:.2f} ms", arranged_blocks_.size(), elapsed.count());
+
+        if (!is_loaded || arranged_blocks_.size() != store_.size()) {
+            LOG("INIT: block store is damaged, blocks won't be saved");
+            store_.close();
+        }
     }
 
-    bool add_block(const block &new_block) {
-        assert(new_block.verify());
+    // Difficulty and timestamp of a block have to follow from its parent's
+    bool check_against_parent(const hashed_block &new_block, arranged_block_index parent) {
+        uint32_t expected_order = next_proof_order(parent);
+        if (new_block.data().proof_order != expected_order) {
+            LOG("RECEIVE: discarding (wrong difficulty {}, expected {}): {}",
+                new_block.data().proof_order, expected_order, new_block.hash());
+            return false;
+        }
+
+        if (new_block.data().timestamp > current_timestamp() + MAX_CLOCK_DRIFT.count()) {
+            LOG("RECEIVE: discarding (timestamp from the future): {}", new_block.hash());
+            return false;
+        }
+
+        // Otherwise first block of a retarget window could be back-dated, to lower difficulty
+        if (new_block.data().timestamp <= arranged_blocks_.data(parent).timestamp) {
+            LOG("RECEIVE: discarding (timestamp not after parent's): {}", new_block.hash());
+            return false;
+        }
+
+        return true;
+    }
 
-        if (is_block_duplicate(new_block)) {
-            LOG("RECIEVE: discarding duplicate: {}", new_block.calculate_hash());
+    // Block's PoW has to be verified already. Blocks below the checkpoint
+    // aren't checked against their parents either.
+    bool add_block(const hashed_block &new_block, bool is_assumed_valid = false) {
+        if (block_registry_.contains(new_block.hash())) {
+            LOG("RECIEVE: discarding duplicate: {}", new_block.hash());
             return true; // It's a duplicate
         }
 
-        hash256_t hash = new_block.previous_hash;
+        hash256_t hash = new_block.data().previous_hash;
 
-        auto parent_iter = block_registry_.find(hash);
-        if (parent_iter == block_registry_.end())
+        arranged_block_index *parent_index = block_registry_.find(hash);
+        if (!parent_index)
             return false; // We don't know anything about block's parent
 
-        auto [_, block_index] = *parent_iter;
-        arranged_block &parent = arranged_blocks_[block_index];
+        if (!is_assumed_valid && !check_against_parent(new_block, *parent_index))
+            return true; // Parent is known, but block is invalid
 
-        arranged_blocks_.emplace_back(new_block);
-        arranged_block_index index = arranged_blocks_.size() - 1;
+        arranged_block_index index = link_block(new_block, *parent_index);
 
-        parent.add_successor(index);
-        LOG("LINK: {} to {}", parent.hash(), parent.successors().size(), arranged_blocks_[index].hash());
+        if (best_tip_ == index)
+            LOG("TIP: switched to {} at height {}", arranged_blocks_.hash(index), arranged_blocks_.height(index));
 
-        block_registry_[arranged_blocks_.back().hash()] = index;
+        LOG("LINK: {} to {}", new_block.hash(), hash);
+        store_block(new_block);
 
         // Mark blocks this block replaced
         for (auto &[block, is_replaced]: pow_blocks_) {
@@ -338,65 +467,353 @@ private:
                 is_replaced = true;
         }
 
+        // Don't waste any more work on the block that's being signed:
+        if (!pow_blocks_.empty() && pow_blocks_.front().is_replaced && miner_.is_running()) {
+            LOG("SIGNING: cancelled, parent: {}", hash);
+            miner_.cancel(miner::cancel_reason::BLOCK_REPLACED);
+        }
+
         return true;
     }
 
-    void receive_block(const block &new_block) {
-        if (!new_block.verify()) {
-            LOG("RECEIVE: discarding (wrong PoW): {}", new_block.calculate_hash());
-            return; // discard the block, it's not signed properly
+    // Blocks hashed by a single validator at once, so that batch hashing
+    // has enough of them to fill all the lanes
+    static constexpr size_t VALIDATION_CHUNK = 64;
+
+    // Received blocks are hashed (and their PoW checked) in parallel,
+    // and only then linked one by one, in the order they came in. Returns
+    // the sender of a block, whose parent we don't have, if there was any
+    std::optional<address> receive_blocks(const std::vector<block> &received,
+                                          const std::vector<address> &received_from) {
+        std::vector<hash256_t> hashes(received.size());
+        std::vector<uint8_t> is_signed(received.size());
+
+        // Validators take every core, mining would only slow them down. It
+        // goes on where it stopped, once they're done, and gets cancelled as
+        // usual, if these blocks replace its block.
+        bool is_mining_paused = received.size() > VALIDATION_CHUNK && miner_.is_running();
+        if (is_mining_paused) {
+            LOG("SIGNING: paused to validate {} blocks", received.size());
+            miner_.pause();
+        }
+
+        validators_.parallel_for(received.size(), VALIDATION_CHUNK, [&](size_t begin, size_t end) {
+            const void* blocks[VALIDATION_CHUNK] = {};
+            for (size_t i = begin; i < end; ++ i)
+                blocks[i - begin] = &received[i];
+
+            // The only time received block gets hashed:
+            hash_with_sha_256_batch(blocks, sizeof(block), end - begin,
+                                    (uint32_t (*)[HASH_SIZE]) hashes[begin].data());
+
+            for (size_t i = begin; i < end; ++ i)
+                is_signed[i] = received[i].verify(hashes[i]);
+        });
+
+        if (is_mining_paused)
+            miner_.resume();
+
+        std::optional<address> missing_from;
+        for (size_t i = 0; i < received.size(); ++ i) {
+            bool is_staged = (checkpoint_ || !assumed_.empty()) && received_from[i] == sync_peer_
+                          && stage_assumed({ received[i], hashes[i] });
+
+            if (!is_staged && receive_block({ received[i], hashes[i] }, is_signed[i]))
+                missing_from = received_from[i];
+        }
+
+        return missing_from;
+    }
+
+    // Returns true, if block turned out to be an orphan
+    bool receive_block(const hashed_block &new_block, bool is_signed) {
+        if (is_block_duplicate(new_block.hash())) {
+            LOG("RECIEVE: discarding duplicate: {}", new_block.hash());
+            return false;
+        }
+
+        if (!is_signed) {
+            LOG("RECEIVE: discarding (wrong PoW): {}", new_block.hash());
+            return false; // discard the block, it's not signed properly
         }
 
         bool has_parent = add_block(new_block);
         if (!has_parent) {
-            pending_blocks_.emplace_back(new_block);
-            LOG("RECEIVE: orphan marked pending: {}", new_block.calculate_hash());
+            orphans_.add(new_block);
+            LOG("RECEIVE: orphan marked pending: {}", new_block.hash());
+            return true;
+        }
+
+        link_orphans(new_block.hash());
+        return false;
+    }
+
+    // Links orphans that waited for the given block, then the ones that
+    // waited for them, and so on
+    void link_orphans(const hash256_t &parent) {
+        if (!block_registry_.contains(parent))
+            return; // Parent turned out to be invalid, children wait to be evicted
+
+        std::vector<hashed_block> waiting = orphans_.take_children(parent);
+
+        while (!waiting.empty()) {
+            hashed_block orphan = std::move(waiting.back());
+            waiting.pop_back();
+
+            bool has_parent = add_block(orphan);
+            assert(has_parent);
+
+            LOG("PENDING: removed processed: {}", orphan.hash());
+
+            if (!block_registry_.contains(orphan.hash()))
+                continue;
+
+            std::vector<hashed_block> children = orphans_.take_children(orphan.hash());
+            waiting.insert(waiting.end(), children.begin(), children.end());
+        }
+    }
+
+    // Sync peer's block is staged, rather than validated, if it's a child
+    // of the last staged one, or of a linked block, if there's none.
+    // Returns false if it has to be validated as usual instead.
+    bool stage_assumed(const hashed_block &sync_block) {
+        if (!assumed_.empty() && sync_block.data().previous_hash != assumed_.back().hash())
+            validate_assumed(); // Run broke, so it can't vouch for the blocks in it
+
+        if (!checkpoint_ || assumed_.size() >= MAX_ASSUMED_BLOCKS) {
+            validate_assumed();
+            return false;
+        }
+
+        if (assumed_.empty() && (!block_registry_.contains(sync_block.data().previous_hash)
+                                 || block_registry_.contains(sync_block.hash())))
+            return false;
+
+        assumed_.push_back(sync_block);
+
+        if (sync_block.hash() == *checkpoint_)
+            link_assumed();
+
+        return true;
+    }
+
+    // Staged blocks are validated as usual, checkpoint isn't among them
+    void validate_assumed() {
+        if (assumed_.empty())
+            return;
+
+        LOG("SYNC: validating {} staged blocks, checkpoint isn't reached", assumed_.size());
+
+        for (const hashed_block &staged: assumed_)
+            receive_block(staged, staged.data().verify(staged.hash()));
+
+        assumed_.clear();
+    }
+
+    // Staged blocks go up to the checkpoint, each one named by its child,
+    // so they're linked without checking their PoW, difficulty or timestamps
+    void link_assumed() {
+        hash256_t checkpoint = *checkpoint_;
+
+        for (const hashed_block &staged: assumed_) {
+            add_block(staged, /*is_assumed_valid*/ true);
+            link_orphans(staged.hash());
+        }
+
+        LOG("SYNC: linked {} blocks below checkpoint {}", assumed_.size(), checkpoint);
+        assumed_.clear();
+    }
+
+    // Ten latest blocks from `index` down, then every 2nd, 4th and so on,
+    // after the hashes locator has already
+    void fill_locator(block_locator &locator, arranged_block_index index) {
+        for (uint64_t step = 1; locator.count < MAX_LOCATOR_HASHES - 1; ) {
+            locator.hashes[locator.count ++] = arranged_blocks_.hash(index);
+
+            uint64_t height = arranged_blocks_.height(index);
+            if (height <= step)
+                break;
+
+            index = find_ancestor(index, step);
+            if (locator.count >= 10)
+                step *= 2;
+        }
+
+        if (locator.hashes[locator.count - 1] != GENESIS_HASH)
+            locator.hashes[locator.count ++] = GENESIS_HASH;
+    }
+
+    // Asks `peer` for the next batch of its best chain above where it forks
+    // from the chain `start` is on, which is our best one, unless we sync.
+    // Blocks that are staged above `start` go first, by the hash of the last one.
+    void request_blocks(address peer, arranged_block_index start, const hash256_t *last_staged = nullptr) {
+        transaction request {
+            .channel = channel_,
+            .type = transaction_type::GET_BLOCKS,
+            .locator = {}
+        };
+
+        if (last_staged)
+            request.locator.hashes[request.locator.count ++] = *last_staged;
+
+        fill_locator(request.locator, start);
+        send(request, peer);
+
+        sync_peer_ = peer;
+        sync_deadline_ = std::chrono::steady_clock::now() + SYNC_TIMEOUT;
+        sync_start_ = start;
+        sync_received_ = 0;
+        ++ sync_requests_;
+
+        LOG("SYNC: requesting blocks from {}, locator of {}", peer.to_string(), request.locator.count);
+    }
+
+    bool is_syncing() {
+        return sync_peer_ && std::chrono::steady_clock::now() < sync_deadline_;
+    }
+
+    // Block, if it's linked. Found among its parent's children, so that
+    // it doesn't have to be hashed again
+    std::optional<arranged_block_index> find_linked(const block &the_block) {
+        const arranged_block_index *parent = block_registry_.find(the_block.previous_hash);
+        if (!parent)
+            return std::nullopt;
+
+        for (arranged_block_index child: arranged_blocks_.successors(*parent))
+            if (memcmp(&arranged_blocks_.data(child), &the_block, sizeof(block)) == 0)
+                return child;
+
+        return std::nullopt;
+    }
+
+    // Requests the next batch above the last block sync peer sent. If that
+    // one didn't link, some got lost, and they're requested above our best
+    // tip again. Sync is over once peer has nothing more, or there's no progress.
+    void continue_sync() {
+        if (!assumed_.empty()) {
+            if (checkpoint_ && sync_received_ > 0) {
+                request_blocks(*sync_peer_, *block_registry_.find(assumed_.front().data().previous_hash),
+                               &assumed_.back().hash());
+                return;
+            }
+
+            // Peer has nothing more, and checkpoint wasn't among what it sent
+            validate_assumed();
         }
+
+        std::optional<arranged_block_index> start;
+        if (sync_received_ > 0)
+            start = find_linked(sync_last_).value_or(best_tip_);
+
+        if (start && *start != sync_start_)
+            request_blocks(*sync_peer_, *start);
+        else {
+            LOG("SYNC: done with {}", sync_peer_->to_string());
+            sync_peer_ = std::nullopt;
+        }
+    }
+
+    // Newly started peer learns our best tip, and requests what's below, if it misses it
+    void send_tip(address requester_address) {
+        transaction tip {
+            .channel = channel_,
+            .type = transaction_type::SYNC,
+            .signed_block = arranged_blocks_.data(best_tip_)
+        };
+
+        send(tip, requester_address);
     }
 
-    void send_sync(address requester_address) {
-        // Send all blocks we have directly to the requester:
-        for (arranged_block &block: arranged_blocks_) {
-            transaction sync {
+    // Sends blocks of our best chain right above where it forks from
+    // requester's one, going up, MAX_SYNC_BLOCKS at most
+    void send_blocks(address requester_address, const block_locator &locator) {
+        arranged_block_index fork = initial_block_index;
+
+        // Locator goes down, so the walk along the best chain does too:
+        arranged_block_index cursor = best_tip_;
+        for (uint32_t i = 0; i < locator.count; ++ i) {
+            const arranged_block_index *index = block_registry_.find(locator.hashes[i]);
+            if (!index || arranged_blocks_.height(*index) > arranged_blocks_.height(cursor))
+                continue;
+
+            cursor = find_ancestor(cursor, arranged_blocks_.height(cursor) - arranged_blocks_.height(*index));
+            if (cursor == *index) {
+                fork = cursor;
+                break;
+            }
+        }
+
+        uint64_t fork_height = arranged_blocks_.height(fork);
+        uint64_t last_height = std::min(arranged_blocks_.height(best_tip_), fork_height + MAX_SYNC_BLOCKS);
+
+        // Batch is collected from its top down, and sent the other way around
+        std::vector<arranged_block_index> batch;
+        for (arranged_block_index index = arranged_blocks_.ancestor(best_tip_, last_height);
+             arranged_blocks_.height(index) > fork_height; index = arranged_blocks_.parent(index))
+            batch.push_back(index);
+
+        std::vector<transaction> syncs;
+        syncs.reserve(batch.size());
+
+        for (auto index = batch.rbegin(); index != batch.rend(); ++ index) {
+            syncs.push_back({
                 .channel = channel_,
                 .type = transaction_type::SYNC,
                 .sequence_number = current_sequence_number_ ++,
-                .signed_block = block.data()
-            };
+                .signed_block = arranged_blocks_.data(*index)
+            });
+        }
 
-            // TODO: Why it doesn't work??
-            // net_.send(sync, requester_address);
+        std::vector<buffer> messages;
+        messages.reserve(syncs.size());
 
-            net_.broadcast(sync);
-            LOG("SYNC: sending: {} <- {}", requester_address.to_string(), block.hash());
-        }
+        for (transaction &sync: syncs)
+            messages.emplace_back(&sync, get_transaction_size(sync));
+
+        size_t sent = net_.send_batch(messages.data(), messages.size(), requester_address);
+        LOG("SYNC: sent {} of {} blocks above {} to {}", sent, messages.size(),
+            arranged_blocks_.hash(fork), requester_address.to_string());
     }
 
-    struct subtree {
-        int depth;
-        arranged_block_index leaf;
-    };
+    void tally_votes(arranged_block_index index, int64_t delta) {
+        const block_data &data = arranged_blocks_.data(index).data;
+        for (int i = 0; i < data.count_votes; ++ i)
+            vote_counts_[(unsigned char) data.votes[i]] += delta;
+    }
 
-    subtree find_longest(arranged_block_iterable_proxy block, int depth = 0) {
-        if (block.size() == 0)
-            return {depth, block.index()};
+    // Moves best tip to the new one, only blocks that are on one of the
+    // branches, but not the other, have their votes recounted
+    void switch_tip(arranged_block_index new_tip) {
+        arranged_block_index old_branch = best_tip_, new_branch = new_tip;
 
-        arranged_block_index max_element = 0;
-        int max_depth = -1;
+        while (arranged_blocks_.height(old_branch) > arranged_blocks_.height(new_branch)) {
+            tally_votes(old_branch, -1);
+            old_branch = arranged_blocks_.parent(old_branch);
+        }
 
-        for (auto &&next: block) {
-            subtree from_next = find_longest(next, depth + 1);
-            if (from_next.depth > max_depth) {
-                max_depth = from_next.depth;
-                max_element = from_next.leaf;
-            }
+        while (arranged_blocks_.height(new_branch) > arranged_blocks_.height(old_branch)) {
+            tally_votes(new_branch, +1);
+            new_branch = arranged_blocks_.parent(new_branch);
         }
 
-        return {max_depth, max_element};
+        // Both are at the same height now, step back until they meet
+        while (old_branch != new_branch) {
+            tally_votes(old_branch, -1);
+            tally_votes(new_branch, +1);
+
+            old_branch = arranged_blocks_.parent(old_branch);
+            new_branch = arranged_blocks_.parent(new_branch);
+        }
+
+        uint64_t depth = arranged_blocks_.height(best_tip_) - arranged_blocks_.height(old_branch);
+        if (old_branch != best_tip_)
+            LOG("TIP: reorganized {} blocks back to {}", depth, arranged_blocks_.hash(old_branch));
+
+        best_tip_ = new_tip;
     }
 
-    arranged_block_iterable_proxy find_longest() {
-        return {arranged_blocks_, find_longest(root()).leaf};
+    arranged_block_iterable_proxy best_tip() {
+        return {arranged_blocks_, best_tip_};
     }
 
     void broadcast_act(action act) {
@@ -412,15 +829,21 @@ private:
     }
 
     void act(action act) {
-        assert(!current_block_ || current_block_->data.is_full());
+        assert(!current_block_ || !current_block_->data.is_full());
 
         if (!current_block_) {
-            // blockchain considers longest chain to be the correct one
-            auto &&last_block = find_longest();
+            // blockchain considers chain with the most work to be the correct one
+            auto &&last_block = best_tip();
             current_block_ = block {
-                .pow_signature = 0 /* to be calculated */,
+                .version = BLOCK_VERSION,
                 .previous_hash = last_block.hash(),
-                .data = {} // TODO: Initial block state?
+                .data = {}, // TODO: Initial block state?
+                .reserved = {},
+                .pow_signature = 0, /* to be calculated */
+                .pow_extra_signature = 0,
+                .timestamp = std::max(current_timestamp(), arranged_blocks_.data(last_block.index()).timestamp + 1),
+                .proof_order = next_proof_order(last_block.index()),
+                .reserved_suffix = {}
             };
         }
 
@@ -431,101 +854,159 @@ private:
         }
     }
 
-    void listen() {
-        while (true) {
-            address sender_address;
-            transaction incoming_transaction;
-            if (!net_.receive(incoming_transaction, &sender_address)) 
-                return;
+    void handle_transaction(const transaction &incoming_transaction, address sender_address,
+                            std::vector<block> &received, std::vector<address> &received_from) {
 
-            if (incoming_transaction.sequence_number < sequence_numbers_[sender_address]) {
-                // TODO: Why it always doubles? WHYYYY??
-                // LOG("LISTEN: discarded transaction - wrong seqno: {}, expected {}",
-                //     incoming_transaction.sequence_number,
-                //     sequence_numbers_[sender_address] - 1
-                // );
-                continue;
-            }
+        // Restarted peer counts from zero again, and says so with DISCOVER
+        bool is_restarted = incoming_transaction.type == transaction_type::DISCOVER;
 
+        if (!is_restarted && incoming_transaction.sequence_number < sequence_numbers_[sender_address]) {
+            // TODO: Why it always doubles? WHYYYY??
+            // LOG("LISTEN: discarded transaction - wrong seqno: {}, expected {}",
+            //     incoming_transaction.sequence_number,
+            //     sequence_numbers_[sender_address] - 1
+            // );
+            return;
+        }
 
-            if (incoming_transaction.magic != BLOCK_MAGIC) {
-                LOG("LISTEN: discarded transaction - wrong magic: {}", sender_address.to_string());
-                continue;
+
+        if (incoming_transaction.magic != BLOCK_MAGIC) {
+            LOG("LISTEN: discarded transaction - wrong magic: {}", sender_address.to_string());
+            return;
+        }
+
+        LOG("LISTEN: received transaction {} (with seqno: {}, was: {}, channel: {}) from {}",
+            get_transaction_name(incoming_transaction.type),
+            incoming_transaction.sequence_number,
+            sequence_numbers_[sender_address],
+            incoming_transaction.channel,
+            sender_address.to_string());
+
+        if (incoming_transaction.channel != channel_) {
+            LOG("LISTEN: discarded transaction - wrong channel {} instead of {}: {}",
+                incoming_transaction.channel, channel_, sender_address.to_string());
+            return;
+        }
+
+        sequence_numbers_[sender_address] = incoming_transaction.sequence_number + 1;
+
+        switch (incoming_transaction.type) {
+        case transaction_type::ACT:
+            act(incoming_transaction.act);
+            break;
+
+        case transaction_type::DISCOVER:
+            send_tip(sender_address);
+            break;
+
+        case transaction_type::GET_BLOCKS:
+            if (incoming_transaction.locator.count == 0 || incoming_transaction.locator.count > MAX_LOCATOR_HASHES) {
+                LOG("LISTEN: discarded transaction - locator of {}: {}",
+                    incoming_transaction.locator.count, sender_address.to_string());
+                break;
             }
 
-            LOG("LISTEN: received transaction {} (with seqno: {}, was: {}, channel: {}) from {}",
-                get_transaction_name(incoming_transaction.type),
-                incoming_transaction.sequence_number,
-                sequence_numbers_[sender_address],
-                incoming_transaction.channel,
-                sender_address.to_string());
+            send_blocks(sender_address, incoming_transaction.locator);
+            break;
 
-            if (incoming_transaction.channel != channel_) {
-                LOG("LISTEN: discarded transaction - wrong channel {} instead of {}: {}",
-                    incoming_transaction.channel, channel_, sender_address.to_string());
-                continue;
+        case transaction_type::NOTIFY_SIGNED:
+            received.push_back(incoming_transaction.signed_block);
+            received_from.push_back(sender_address);
+            break;
+
+        case transaction_type::SYNC:
+            received.push_back(incoming_transaction.signed_block);
+            received_from.push_back(sender_address);
+
+            if (sync_peer_ == sender_address) {
+                ++ sync_received_;
+                sync_last_ = incoming_transaction.signed_block;
+                sync_deadline_ = std::chrono::steady_clock::now() + SYNC_TIMEOUT;
             }
+            break;
+        }
+    }
 
-            sequence_numbers_[sender_address] = incoming_transaction.sequence_number + 1;
+    void listen() {
+        // Blocks are validated together, once everything is received
+        std::vector<block> received;
+        std::vector<address> received_from;
 
-            switch (incoming_transaction.type) {
-            case transaction_type::ACT:
-                act(incoming_transaction.act);
-                break;
+        transaction incoming_transactions[TRANSACTION_BATCH];
+        address sender_addresses[TRANSACTION_BATCH];
 
-            case transaction_type::DISCOVER:
-                send_sync(sender_address);
-                break;
+        std::vector<buffer> messages;
+        messages.reserve(TRANSACTION_BATCH);
 
-            case transaction_type::NOTIFY_SIGNED:
-                receive_block(incoming_transaction.signed_block);
+        while (true) {
+            // Receiving shrinks buffers to the messages, and reorders them, or
+            // points them into network's own memory, until the next receive
+            messages.clear();
+            for (transaction &incoming_transaction: incoming_transactions)
+                messages.emplace_back(incoming_transaction);
+
+            size_t count = net_.receive_batch(messages.data(), sender_addresses, TRANSACTION_BATCH);
+            if (count == 0)
                 break;
 
-            case transaction_type::SYNC:
-                receive_block(incoming_transaction.signed_block);
-                break;
+            for (size_t i = 0; i < count; ++ i) {
+                const transaction &incoming_transaction = *static_cast<const transaction*>(messages[i].data);
+
+                if (messages[i].size < TRANSACTION_HEADER_SIZE
+                    || messages[i].size != get_transaction_size(incoming_transaction)) {
+
+                    LOG("LISTEN: discarded transaction - wrong size {}: {}",
+                        messages[i].size, sender_addresses[i].to_string());
+                    continue;
+                }
+
+                handle_transaction(incoming_transaction, sender_addresses[i], received, received_from);
             }
         }
+
+        std::optional<address> missing_from = receive_blocks(received, received_from);
+
+        if (sync_peer_ && sync_received_ >= MAX_SYNC_BLOCKS)
+            continue_sync(); // Whole batch came, there's likely more
+        else if (missing_from && !is_syncing())
+            request_blocks(*missing_from, best_tip_);
     }
 
-    void notify_signed(block &new_block) {
+    void notify_signed(const hashed_block &new_block) {
         assert(new_block.verify());
 
         transaction signed_new {
             .channel = channel_,
             .type = transaction_type::NOTIFY_SIGNED,
             .sequence_number = current_sequence_number_ ++,
-            .signed_block = new_block,
+            .signed_block = new_block.data(),
         };
 
         broadcast(signed_new);
-        LOG("NOTIFY: broadcasting newly signed {}", pow_blocks_.front().the_block.calculate_hash());
+        LOG("NOTIFY: broadcasting newly signed {}", new_block.hash());
     }
 
-    void update_pending() {
-        bool updated = false;
+    void evict_orphans() {
+        if (size_t evicted = orphans_.evict())
+            LOG("PENDING: evicted {} orphans, {} left", evicted, orphans_.size());
+    }
 
-        do {
-            // One of the pending blocks might be a parent of another pending block,
-            // we need to repeat the process to process all of them:
-            updated = false;
+    void try_signing() {
+        if (miner_.is_running())
+            return; // Job gets cancelled right away if its block is replaced
 
-            for (auto it = pending_blocks_.begin(); it != pending_blocks_.end(); ) {
-                if (add_block(*it)) {
-                    LOG("PENDING: removed processed: {}", it->calculate_hash());
-                    it = pending_blocks_.erase(it);
+        if (std::optional<block> signed_block = miner_.poll()) {
+            hashed_block new_block { *signed_block };
+            LOG("SIGNING: successfully signed: {}", new_block.hash());
 
-                    updated = true;
-                } else {
-                    ++ it;
-                }
-            }
-        } while (updated);
-    }
+            notify_signed(new_block);
+            bool has_parent = add_block(new_block);
+            assert(has_parent);
 
-    void try_signing(std::chrono::milliseconds timeout) {
-        if (pow_blocks_.empty())
-            return;
+            link_orphans(new_block.hash());
+
+            pow_blocks_.pop_front();
+        }
 
         // TODO: verify parent
 
@@ -538,13 +1019,8 @@ private:
         if (pow_blocks_.empty())
             return;
 
-        if (sign_block(pow_blocks_.front().the_block, timeout)) {
-            notify_signed(pow_blocks_.front().the_block);
-            bool has_parent = add_block(pow_blocks_.front().the_block);
-            assert(has_parent);
-
-            pow_blocks_.pop_front();
-        }
+        assert(!pow_blocks_.front().the_block.verify());
+        miner_.start(pow_blocks_.front().the_block);
     }
 
     bool check_need_to_act(const std::string& filename, char& out_char) {
@@ -560,7 +1036,7 @@ private:
 
     void act_if_requested() {
         char vote;
-        if (check_need_to_act("act", vote)) {
+        if (check_need_to_act(ACT_FILE, vote)) {
             LOG("ACT: registered need to act with '{}'", vote);
 
             action action { vote };
@@ -572,30 +1048,115 @@ private:
 
     void broadcast(transaction message) {
         message.sequence_number = current_sequence_number_ ++;
-        net_.broadcast(message);
+        net_.broadcast({ &message, get_transaction_size(message) });
     }
 
-    char who_wins() {
-        auto longest = find_longest();
+    void send(transaction message, address target) {
+        message.sequence_number = current_sequence_number_ ++;
+        net_.send({ &message, get_transaction_size(message) }, target);
+    }
 
-        char counts[256] = {};
-        while (true) {
-            if (longest.index() == 0)
-                break;
+    void tick() {
+        mining_stats stats = miner_.stats();
+
+        LOG("STATUS pow signing: {}, pending: {}, total: {}, current votes: {}, hashrate: {:.2f} MH/s",
+            pow_blocks_.size(),
+            orphans_.size(),
+            arranged_blocks_.size(),
+            current_block_ ? current_block_->data.count_votes : 0,
+            stats.hashes_per_second() / 1e6);
+
+        if (stats_pane_ && get_global_log_multiplexer())
+            get_global_log_multiplexer()->assign(*stats_pane_, describe_mining_stats(stats));
 
-            for (int i = 0; i < longest.data().data.count_votes; ++ i) {
-                counts[longest.data().data.votes[i]] ++;
+        evict_orphans();
+        act_if_requested();
+
+        // Sync peer went silent, either it sent everything, or blocks got lost
+        if (sync_peer_ && !is_syncing())
+            continue_sync();
+    }
+
+    void handle_event(event_source source) {
+        switch (source) {
+        case event_source::NETWORK:
+            listen();
+            break;
+
+        case event_source::MINER:
+            event_loop::drain(miner_.completion_fd()); // Signed block is taken below
+            break;
+
+        case event_source::TICK:
+            event_loop::drain(tick_timer_fd_);
+            tick();
+            break;
+
+        case event_source::ACT_FILE:
+            if (event_loop::has_file_changed(act_watch_fd_, ACT_FILE)) {
+                act_if_requested();
+
+                // Next vote is a whole tick away, however early this one was
+                event_loop::restart_timer(tick_timer_fd_, TICK_INTERVAL);
+            }
+            break;
+
+        case event_source::ADDRESS_CHANGE:
+            net_.refresh_local_addresses(); // Drains it
+            break;
+
+        case event_source::STOP:
+            event_loop::drain(stop_fd_); // Loop checks should_stop_ itself
+            break;
+        }
+    }
+
+public:
+    // Handles events on the calling thread, until stop() is called
+    void run() {
+        tick();
+
+        while (!should_stop_.load(std::memory_order_acquire)) {
+            uint32_t sources[NUM_EVENT_SOURCES];
+            size_t count = events_.wait(sources, NUM_EVENT_SOURCES);
+
+            if (count == 0) {
+                // Event loop is broken, poll everything once per tick instead
+                std::this_thread::sleep_for(TICK_INTERVAL);
+
+                listen();
+                tick();
             }
 
-            auto next_index = block_registry_[longest.data().previous_hash];
-            longest = arranged_block_iterable_proxy{arranged_blocks_, next_index};
+            for (size_t i = 0; i < count; ++ i)
+                handle_event((event_source) sources[i]);
+
+            // Mining is (re)started after anything that could replace its block
+            try_signing();
         }
 
+        miner_.cancel(); // Nobody is going to take its block anymore
+        should_stop_.store(false, std::memory_order_relaxed);
+    }
+
+    // Makes run() return, once it's done with events it's handling now,
+    // it can be called again after that. Can be called from any thread.
+    void stop() {
+        should_stop_.store(true, std::memory_order_release);
+        event_loop::notify(stop_fd_);
+    }
+
+    // Votes in the blocks of the best chain, by candidate
+    const std::array<uint64_t, 256> &get_vote_counts() const {
+        return vote_counts_;
+    }
+
+    char who_wins() const {
         char winner = '0';
-        int max_votes = 0;
+        uint64_t max_votes = 0;
         for (int candidate = 0; candidate < 256; ++ candidate) {
-            if (max_votes < counts[candidate]) {
-                max_votes = counts[candidate];
+            if (max_votes < vote_counts_[candidate]) {
+                max_votes = vote_counts_[candidate];
                 winner = candidate;
             }
         }
@@ -603,30 +1164,30 @@ private:
         return winner;
     }
 
-public:
-    void run() {
-        static constexpr std::chrono::milliseconds min_iteration_time{1000};
-
-        while (true) {
-            LOG("STATUS pow signing: {}, pending: {}, total: {}, current votes: {}",
-                pow_blocks_.size(),
-                pending_blocks_.size(),
-                arranged_blocks_.size(),
-                current_block_ ? current_block_->data.count_votes : 0);
+    // Requests for missing blocks, each brings MAX_SYNC_BLOCKS at most
+    uint64_t get_sync_requests() const {
+        return sync_requests_;
+    }
 
-            auto start = std::chrono::high_resolution_clock::now();
+    size_t get_orphan_count() const {
+        return orphans_.size();
+    }
 
-            listen();
-            update_pending();
-            try_signing(min_iteration_time);
-            act_if_requested();
+    mining_stats get_mining_stats() const {
+        return miner_.stats();
+    }
 
-            auto now = std::chrono::high_resolution_clock::now();
-            std::chrono::duration<double> elapsed = now - start;
+    // Mining counters get redrawn in this pane on every tick()
+    void show_mining_stats(pane_id pane) {
+        stats_pane_ = pane;
+    }
 
-            if (elapsed < min_iteration_time)
-                std::this_thread::sleep_for(min_iteration_time - elapsed);
-        }
+    // Assume that block with this hash, and all of its ancestors are valid.
+    // Until it's linked, blocks that sync brings up to it aren't checked for
+    // PoW, difficulty or timestamps, see checkpoint_.
+    void assume_valid(const hash256_t &checkpoint) {
+        if (!block_registry_.contains(checkpoint))
+            checkpoint_ = checkpoint;
     }
 
     arranged_block_iterable_proxy root() {
@@ -1,17 +1,27 @@
 #include "broadcast.h"
 #include "log.h"
 
+#include <algorithm>
 #include <arpa/inet.h>
 #include <cstring>
+#include <errno.h>
 #include <fcntl.h>
 #include <ifaddrs.h>
+#include <linux/io_uring.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <memory>
 #include <net/if.h>
 #include <netinet/in.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <unistd.h>
+#include <utility>
+#include <vector>
 
 
 namespace {
@@ -93,29 +103,75 @@ int create_peer2peer_socket() {
     return sock;
 }    
 
-bool is_mine_address(const sockaddr_in& addr) {
-    ifaddrs *ifaddr, *ifa;
+// Socket that gets a message every time an IPv4 address is added to or
+// removed from some interface. Reading it is non-blocking.
+int create_netlink_socket() {
+    int sock = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK, NETLINK_ROUTE);
+    if (sock < 0) {
+        perror("Netlink socket creation failed");
+        return -1;
+    }
+
+    sockaddr_nl netlink_address = {};
+    netlink_address.nl_family = AF_NETLINK;
+    netlink_address.nl_groups = RTMGRP_IPV4_IFADDR;
+
+    if (bind(sock, (struct sockaddr*) &netlink_address, sizeof(netlink_address)) < 0) {
+        perror("Netlink bind failed");
+        close(sock);
+
+        return -1;
+    }
+
+    return sock;
+}
+
+// Sorted, so that they are binary searched
+std::vector<in_addr_t> get_local_addresses() {
+    std::vector<in_addr_t> addresses;
+
+    ifaddrs *ifaddr;
     if (getifaddrs(&ifaddr) == -1) {
         perror("getifaddrs");
-        return false; // Handle error appropriately
+        return addresses;
     }
 
     for (ifaddrs *ifa = ifaddr; ifa != nullptr; ifa = ifa->ifa_next) {
-        if (ifa->ifa_addr == nullptr || ifa->ifa_addr->sa_family != addr.sin_family) {
+        if (ifa->ifa_addr == nullptr || ifa->ifa_addr->sa_family != AF_INET)
             continue;
-        }
 
-        if (ifa->ifa_addr->sa_family == AF_INET) {
-            const struct sockaddr_in* ifa_addr = reinterpret_cast<const struct sockaddr_in*>(ifa->ifa_addr);
-            if (memcmp(&addr.sin_addr, &ifa_addr->sin_addr, sizeof(addr.sin_addr)) == 0) {
-                freeifaddrs(ifaddr);
-                return true;
-            }
-        }
+        const struct sockaddr_in* ifa_addr = reinterpret_cast<const struct sockaddr_in*>(ifa->ifa_addr);
+        addresses.push_back(ifa_addr->sin_addr.s_addr);
     }
 
     freeifaddrs(ifaddr);
-    return false;
+
+    std::sort(addresses.begin(), addresses.end());
+    addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+    return addresses;
+}
+
+// Drains pending notifications, returns true if there were any
+bool have_addresses_changed(int netlink_sock) {
+    bool changed = false;
+
+    char notification[4096];
+    while (true) {
+        if (recv(netlink_sock, notification, sizeof(notification), 0) >= 0) {
+            changed = true;
+            continue;
+        }
+
+        if (errno == ENOBUFS) {
+            changed = true; // Some notifications got lost
+            continue;
+        }
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            perror("Netlink receive failed");
+
+        return changed;
+    }
 }
 
 } // end anonymous namespace
@@ -123,11 +179,54 @@ bool is_mine_address(const sockaddr_in& addr) {
 
 
 struct network_impl {
+    explicit network_impl(uint16_t port):
+        port(port),
+        broadcast_sock(create_broadcast_socket()),
+        receiving_sock(create_receiving_socket(port)),
+        peer2peer_sock(create_peer2peer_socket()),
+        local_addresses(),
+        netlink_sock(create_netlink_socket()) {
+
+        // Read after subscribing to netlink, so that no change is missed
+        local_addresses = get_local_addresses();
+    }
+
+    ~network_impl() {
+        for (int sock: { broadcast_sock, receiving_sock, peer2peer_sock, netlink_sock })
+            if (sock >= 0)
+                close(sock);
+    }
+
+    network_impl(const network_impl &other) = delete;
+    network_impl& operator=(const network_impl &other) = delete;
+
     uint16_t port;
 
     int broadcast_sock;
     int receiving_sock;
     int peer2peer_sock;
+
+    // Addresses of local interfaces, packets from them are our own
+    // broadcasts. Refreshed only after netlink says they've changed, and
+    // never, if netlink socket couldn't be created.
+    std::vector<in_addr_t> local_addresses;
+
+    int netlink_sock;
+
+    // Messages come from ephemeral ports of the sending sockets, while
+    // replies have to go to the port every node receives on
+    void set_reply_port(sockaddr_in &sender_address) {
+        sender_address.sin_port = htons(port);
+    }
+
+    bool is_local_address(const sockaddr_in &addr) const {
+        return std::binary_search(local_addresses.begin(), local_addresses.end(), addr.sin_addr.s_addr);
+    }
+
+    void refresh_local_addresses() {
+        if (netlink_sock >= 0 && have_addresses_changed(netlink_sock))
+            local_addresses = get_local_addresses();
+    }
 };
 
 
@@ -143,63 +242,772 @@ std::string address::to_string() {
 
 
 network::network(uint16_t port):
-    pimpl_(std::make_shared<network_impl>(network_impl {
-        .port = port,
-        .broadcast_sock = create_broadcast_socket(),
-        .receiving_sock = create_receiving_socket(port),
-        .peer2peer_sock = create_peer2peer_socket()
-    })) {
+    pimpl_(std::make_shared<network_impl>(port)) {
+}
+
+namespace {
+
+// Sends all messages to the same address, in batches of network::MAX_BATCH
+size_t send_messages(int sock, const buffer *messages, size_t count, const sockaddr_in &target) {
+    size_t sent = 0;
+    while (sent < count) {
+        size_t batch_size = std::min(count - sent, network::MAX_BATCH);
+
+        mmsghdr headers[network::MAX_BATCH];
+        iovec vectors[network::MAX_BATCH];
+
+        for (size_t i = 0; i < batch_size; ++ i) {
+            vectors[i] = { .iov_base = messages[sent + i].data, .iov_len = messages[sent + i].size };
+            headers[i] = {
+                .msg_hdr = {
+                    .msg_name = (void*) &target,
+                    .msg_namelen = sizeof(target),
+                    .msg_iov = &vectors[i],
+                    .msg_iovlen = 1,
+                    .msg_control = nullptr,
+                    .msg_controllen = 0,
+                    .msg_flags = 0
+                },
+                .msg_len = 0
+            };
+        }
+
+        int sent_count = sendmmsg(sock, headers, batch_size, 0);
+        if (sent_count < 0) {
+            if (errno == EINTR)
+                continue;
+
+            perror("Error sending messages");
+            break;
+        }
+
+        sent += sent_count;
+    }
+
+    return sent;
 }
 
+sockaddr_in get_broadcast_address(uint16_t port) {
+    return {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr = { .s_addr = inet_addr(BROADCAST_IP) },
+        .sin_zero = {}
+    };
+}
+
+} // end anonymous namespace
+
 bool network::send(buffer message, address target_addr) {
-    ssize_t sent_length = sendto(pimpl_->peer2peer_sock, message.data, message.size, 0,
-                                 (struct sockaddr *) &target_addr, sizeof(target_addr));
-    if (sent_length < 0) {
-        perror("Error sending message");
+    return send_batch(&message, 1, target_addr) == 1;
+}
+
+bool network::broadcast(buffer message) {
+    return broadcast_batch(&message, 1) == 1;
+}
+
+bool network::receive(buffer out_message, address *out_sender_addr) {
+    return receive_batch(&out_message, out_sender_addr, 1) == 1;
+}
+
+size_t network::send_batch(const buffer *messages, size_t count, address target_addr) {
+    sockaddr_in target;
+    std::memcpy(&target, &target_addr, sizeof(target));
+
+    return send_messages(pimpl_->peer2peer_sock, messages, count, target);
+}
+
+size_t network::broadcast_batch(const buffer *messages, size_t count) {
+    return send_messages(pimpl_->broadcast_sock, messages, count, get_broadcast_address(pimpl_->port));
+}
+
+size_t network::receive_batch(buffer *out_messages, address *out_sender_addrs, size_t count) {
+    count = std::min(count, MAX_BATCH);
+
+    mmsghdr headers[MAX_BATCH];
+    iovec vectors[MAX_BATCH];
+    sockaddr_in sender_addresses[MAX_BATCH];
+
+    while (true) {
+        for (size_t i = 0; i < count; ++ i) {
+            vectors[i] = { .iov_base = out_messages[i].data, .iov_len = out_messages[i].size };
+            headers[i] = {
+                .msg_hdr = {
+                    .msg_name = &sender_addresses[i],
+                    .msg_namelen = sizeof(sender_addresses[i]),
+                    .msg_iov = &vectors[i],
+                    .msg_iovlen = 1,
+                    .msg_control = nullptr,
+                    .msg_controllen = 0,
+                    .msg_flags = 0
+                },
+                .msg_len = 0
+            };
+        }
+
+        int received_count = recvmmsg(pimpl_->receiving_sock, headers, count, 0, nullptr);
+        if (received_count <= 0) {
+            // TODO: check if this error or async
+            return 0;
+        }
+
+        // Own broadcasts are skipped, the rest is moved to the front:
+        size_t kept = 0;
+        for (size_t i = 0; i < (size_t) received_count; ++ i) {
+            if (pimpl_->is_local_address(sender_addresses[i]))
+                continue;
+
+            std::swap(out_messages[kept], out_messages[i]);
+            out_messages[kept].size = headers[i].msg_len;
+
+            pimpl_->set_reply_port(sender_addresses[i]);
+            std::memcpy(&out_sender_addrs[kept], &sender_addresses[i], sizeof(sockaddr_in));
+
+            ++ kept;
+        }
+
+        // There might be messages from others after a full batch of own ones
+        if (kept != 0 || (size_t) received_count < count)
+            return kept;
+    }
+}
+
+int network::receive_fd() const {
+    return pimpl_->receiving_sock;
+}
+
+int network::address_change_fd() const {
+    return pimpl_->netlink_sock;
+}
+
+void network::refresh_local_addresses() {
+    pimpl_->refresh_local_addresses();
+}
+
+network::~network() = default;
+
+
+namespace {
+
+// Receive buffers the kernel picks from, each holds a single datagram
+// (along with its sender), longer ones get truncated
+constexpr unsigned RECEIVE_BUFFERS = 256;
+constexpr size_t RECEIVE_BUFFER_SIZE = 2048;
+constexpr uint16_t RECEIVE_BUFFER_GROUP = 0;
+
+// Messages being sent are copied here, and stay until their completions
+// are reaped. More than that in flight, and sending waits for some.
+constexpr unsigned SEND_SLOTS = network::MAX_BATCH * 2;
+
+int uring_setup(unsigned entries, io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+int uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Submission and completion queues of a single io_uring, mapped into
+// memory. Only one thread may use it at a time.
+class uring {
+public:
+    uring():
+        fd_(-1),
+        rings_(MAP_FAILED), rings_size_(0),
+        sqes_((io_uring_sqe*) MAP_FAILED), sqes_size_(0),
+        sq_head_(), sq_tail_(), sq_mask_(), sq_entries_(), sq_array_(),
+        cq_head_(), cq_tail_(), cq_mask_(), cqes_(),
+        pending_(0) {
+    }
+
+    ~uring() { close(); }
+
+    uring(const uring &other) = delete;
+    uring& operator=(const uring &other) = delete;
+
+    bool setup(unsigned entries, unsigned completion_entries) {
+        io_uring_params params = {};
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = completion_entries;
+
+        fd_ = uring_setup(entries, &params);
+        if (fd_ < 0) {
+            perror("io_uring_setup");
+            return false;
+        }
+
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+            fprintf(stderr, "io_uring: kernel is too old\n");
+            close();
+
+            return false;
+        }
+
+        // Both queues share the same mapping:
+        rings_size_ = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                               params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        rings_ = mmap(nullptr, rings_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = (io_uring_sqe*) mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+
+        if (rings_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+            perror("mmap");
+            close();
+
+            return false;
+        }
+
+        char *rings = (char*) rings_;
+
+        sq_head_    = (unsigned*) (rings + params.sq_off.head);
+        sq_tail_    = (unsigned*) (rings + params.sq_off.tail);
+        sq_mask_    = (unsigned*) (rings + params.sq_off.ring_mask);
+        sq_entries_ = (unsigned*) (rings + params.sq_off.ring_entries);
+        sq_array_   = (unsigned*) (rings + params.sq_off.array);
+
+        cq_head_ = (unsigned*) (rings + params.cq_off.head);
+        cq_tail_ = (unsigned*) (rings + params.cq_off.tail);
+        cq_mask_ = (unsigned*) (rings + params.cq_off.ring_mask);
+        cqes_    = (io_uring_cqe*) (rings + params.cq_off.cqes);
+
+        return true;
+    }
+
+    void close() {
+        if (sqes_ != MAP_FAILED)
+            munmap(sqes_, sqes_size_);
+
+        if (rings_ != MAP_FAILED)
+            munmap(rings_, rings_size_);
+
+        if (fd_ >= 0)
+            ::close(fd_);
+
+        fd_ = -1;
+        rings_ = MAP_FAILED;
+        sqes_ = (io_uring_sqe*) MAP_FAILED;
+    }
+
+    int fd() const { return fd_; }
+
+    // Queued, but not submitted yet
+    unsigned pending() const { return pending_; }
+
+    // Eventfd gets signaled on every completion
+    bool register_eventfd(int event_fd) {
+        if (uring_register(fd_, IORING_REGISTER_EVENTFD, &event_fd, 1) < 0) {
+            perror("io_uring_register");
+            return false;
+        }
+
+        return true;
+    }
+
+    // Cleared submission, that's going to be sent with the next submit(),
+    // or null, if the queue is full
+    io_uring_sqe *get_sqe() {
+        unsigned tail = *sq_tail_;
+        if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == *sq_entries_)
+            return nullptr;
+
+        unsigned index = tail & *sq_mask_;
+
+        io_uring_sqe *sqe = &sqes_[index];
+        memset(sqe, 0, sizeof(*sqe));
+
+        sq_array_[index] = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+        ++ pending_;
+        return sqe;
+    }
+
+    // Submits everything queued, then waits until there are `wait_for` completions
+    bool submit(unsigned wait_for = 0) {
+        while (true) {
+            int submitted = uring_enter(fd_, pending_, wait_for, wait_for > 0 ? IORING_ENTER_GETEVENTS : 0);
+            if (submitted < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                perror("io_uring_enter");
+                return false;
+            }
+
+            pending_ -= submitted;
+
+            // Waiting could've been interrupted after submission
+            if (__atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) - *cq_head_ >= wait_for)
+                return true;
+        }
+    }
+
+    // Takes back everything queued since the last submit(), so that it's
+    // never submitted. Returns how many submissions were taken back.
+    unsigned withdraw() {
+        unsigned withdrawn = pending_;
+        __atomic_store_n(sq_tail_, *sq_tail_ - withdrawn, __ATOMIC_RELEASE);
+
+        pending_ = 0;
+        return withdrawn;
+    }
+
+    // Oldest completion that wasn't consumed yet, or null, if there's none
+    io_uring_cqe *peek() {
+        unsigned head = *cq_head_;
+        if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+            return nullptr;
+
+        return &cqes_[head & *cq_mask_];
+    }
+
+    // Frees the slot of a completion returned by peek()
+    void consume() {
+        __atomic_store_n(cq_head_, *cq_head_ + 1, __ATOMIC_RELEASE);
+    }
+
+private:
+    int fd_;
+
+    void *rings_;
+    size_t rings_size_;
+
+    io_uring_sqe *sqes_;
+    size_t sqes_size_;
+
+    unsigned *sq_head_, *sq_tail_, *sq_mask_, *sq_entries_, *sq_array_;
+    unsigned *cq_head_, *cq_tail_, *cq_mask_;
+    io_uring_cqe *cqes_;
+
+    unsigned pending_; // Queued, but not submitted yet
+};
+
+} // end anonymous namespace
+
+
+struct uring_network_impl {
+    explicit uring_network_impl(uint16_t port);
+    ~uring_network_impl();
+
+    network_impl sockets;
+
+    // Kernel takes receive buffers from this ring. Received messages are
+    // handed out right from them, and they are put back on the next receive
+    io_uring_buf_ring *buffer_ring;
+    std::unique_ptr<char[]> buffers;
+    std::vector<uint16_t> held_buffers;
+
+    msghdr receive_header;
+
+    struct send_slot {
+        msghdr header;
+        iovec vector;
+        sockaddr_in target;
+        std::vector<char> payload;
+    };
+
+    // Indices of free ones are kept in free_send_slots, user_data of each
+    // send is the index of its slot
+    std::vector<send_slot> send_slots;
+    std::vector<uint32_t> free_send_slots;
+    std::vector<uint32_t> unsubmitted_send_slots;
+
+    uring receiver;
+    uring sender;
+
+    // Registered with both rings, so that event loop wakes up to reap sends too
+    int completion_fd;
+
+    bool is_receiving; // Multishot receive is armed
+    bool is_ready;
+
+    bool setup_buffers();
+    bool start_receiving();
+    void recycle(uint16_t buffer_id);
+
+    size_t send(int sock, const buffer *messages, size_t count, const sockaddr_in &target);
+    int take_send_slot();
+    bool submit_sends(unsigned wait_for = 0);
+    void reap_sends();
+    void wait_for_sends();
+};
+
+uring_network_impl::uring_network_impl(uint16_t port):
+    sockets(port),
+    buffer_ring((io_uring_buf_ring*) MAP_FAILED),
+    buffers(std::make_unique<char[]>(RECEIVE_BUFFERS * RECEIVE_BUFFER_SIZE)),
+    held_buffers(),
+    receive_header(),
+    send_slots(SEND_SLOTS),
+    free_send_slots(),
+    unsubmitted_send_slots(),
+    receiver(),
+    sender(),
+    completion_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    is_receiving(false),
+    is_ready(false) {
+
+    held_buffers.reserve(RECEIVE_BUFFERS);
+
+    for (uint32_t slot = SEND_SLOTS; slot > 0; -- slot)
+        free_send_slots.push_back(slot - 1);
+
+    if (sockets.receiving_sock < 0 || sockets.broadcast_sock < 0 || sockets.peer2peer_sock < 0)
+        return;
+
+    if (completion_fd < 0) {
+        perror("eventfd");
+        return;
+    }
+
+    // Every buffer might end up as a completion at once, even if they aren't
+    // read, and so might every send slot:
+    if (!receiver.setup(4, RECEIVE_BUFFERS * 2) || !sender.setup(network::MAX_BATCH, SEND_SLOTS))
+        return;
+
+    if (!receiver.register_eventfd(completion_fd) || !sender.register_eventfd(completion_fd))
+        return;
+
+    if (!setup_buffers())
+        return;
+
+    // Sender goes first in every buffer, right after the io_uring_recvmsg_out
+    receive_header.msg_namelen = sizeof(sockaddr_in);
+
+    is_ready = start_receiving();
+}
+
+uring_network_impl::~uring_network_impl() {
+    // Before buffers and send slots are gone
+    wait_for_sends();
+    sender.close();
+    receiver.close();
+
+    if (completion_fd >= 0)
+        close(completion_fd);
+
+    if (buffer_ring != MAP_FAILED)
+        munmap(buffer_ring, RECEIVE_BUFFERS * sizeof(io_uring_buf));
+}
+
+bool uring_network_impl::setup_buffers() {
+    buffer_ring = (io_uring_buf_ring*) mmap(nullptr, RECEIVE_BUFFERS * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+                                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer_ring == MAP_FAILED) {
+        perror("mmap");
         return false;
     }
 
+    io_uring_buf_reg registration = {
+        .ring_addr = (uint64_t) buffer_ring,
+        .ring_entries = RECEIVE_BUFFERS,
+        .bgid = RECEIVE_BUFFER_GROUP,
+        .pad = 0,
+        .resv = {}
+    };
+
+    if (uring_register(receiver.fd(), IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+        perror("io_uring_register");
+        return false;
+    }
+
+    buffer_ring->tail = 0;
+    for (uint16_t id = 0; id < RECEIVE_BUFFERS; ++ id)
+        recycle(id);
+
     return true;
 }
 
-bool network::broadcast(buffer message) {
-    sockaddr_in broadcasting_address =  {
-        .sin_family = AF_INET,
-        .sin_port = htons(pimpl_->port),
-        .sin_addr = { .s_addr = inet_addr(BROADCAST_IP) }
-    };
+void uring_network_impl::recycle(uint16_t buffer_id) {
+    uint16_t tail = buffer_ring->tail;
+
+    // Not buffer_ring->bufs: empty struct inside __DECLARE_FLEX_ARRAY takes
+    // a byte in C++, which shifts them. Entries start right at the ring.
+    io_uring_buf &entry = ((io_uring_buf*) buffer_ring)[tail & (RECEIVE_BUFFERS - 1)];
+
+    // Fields one by one, resv of the first entry is the tail
+    entry.addr = (uint64_t) (buffers.get() + buffer_id * RECEIVE_BUFFER_SIZE);
+    entry.len = RECEIVE_BUFFER_SIZE;
+    entry.bid = buffer_id;
+
+    __atomic_store_n(&buffer_ring->tail, uint16_t(tail + 1), __ATOMIC_RELEASE);
+}
+
+bool uring_network_impl::start_receiving() {
+    io_uring_sqe *sqe = receiver.get_sqe();
+    if (sqe == nullptr)
+        return false;
+
+    // Single submission keeps receiving, until buffers run out:
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = sockets.receiving_sock;
+    sqe->addr = (uint64_t) &receive_header;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECEIVE_BUFFER_GROUP;
 
-    if (sendto(pimpl_->broadcast_sock, message.data, message.size, 0, (struct sockaddr *) &broadcasting_address, sizeof(broadcasting_address)) < 0) {
-        perror("Error sending broadcast message");
+    if (!receiver.submit())
+        return false;
+
+    // Kernels without multishot receive reject it right away:
+    io_uring_cqe *cqe = receiver.peek();
+    if (cqe != nullptr && cqe->res < 0 && cqe->res != -ENOBUFS) {
+        errno = -cqe->res;
+        perror("io_uring multishot receive");
+
+        receiver.consume();
         return false;
     }
 
+    is_receiving = true;
     return true;
 }
 
-bool network::receive(buffer out_message, address *out_sender_addr) {
-    std::memset(out_message.data, 0, out_message.size);
+size_t uring_network_impl::send(int sock, const buffer *messages, size_t count, const sockaddr_in &target) {
+    if (sender.fd() < 0)
+        return 0; // Sending has failed for good before
+
+    reap_sends();
+
+    size_t queued = 0;
+    for (; queued < count; ++ queued) {
+        int slot_index = take_send_slot();
+        if (slot_index < 0)
+            break;
+
+        // Messages are copied, so that caller doesn't have to keep them until they're sent
+        send_slot &slot = send_slots[slot_index];
+        slot.payload.assign((const char*) messages[queued].data, (const char*) messages[queued].data + messages[queued].size);
+        slot.target = target;
+
+        slot.vector = { .iov_base = slot.payload.data(), .iov_len = slot.payload.size() };
+        slot.header = {
+            .msg_name = &slot.target,
+            .msg_namelen = sizeof(slot.target),
+            .msg_iov = &slot.vector,
+            .msg_iovlen = 1,
+            .msg_control = nullptr,
+            .msg_controllen = 0,
+            .msg_flags = 0
+        };
+
+        io_uring_sqe *sqe = sender.get_sqe();
+        if (sqe == nullptr && submit_sends())
+            sqe = sender.get_sqe(); // Queue was full, now it's taken by the kernel
+
+        if (sqe == nullptr) {
+            free_send_slots.push_back(slot_index);
+            break;
+        }
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = sock;
+        sqe->addr = (uint64_t) &slot.header;
+        sqe->len = 1;
+        sqe->user_data = slot_index;
+
+        unsubmitted_send_slots.push_back(slot_index);
+    }
+
+    // Completions are reaped later, from receive_batch() or the next send
+    size_t unsubmitted = unsubmitted_send_slots.size();
+    if (!submit_sends())
+        queued -= std::min(queued, unsubmitted - unsubmitted_send_slots.size()); // Withdrawn
+
+    return queued;
+}
+
+// Index of a free send slot, waits for a send to complete, if there's none
+int uring_network_impl::take_send_slot() {
+    while (free_send_slots.empty()) {
+        if (!submit_sends(1)) {
+            fprintf(stderr, "io_uring: couldn't wait for sends to complete\n");
+            return -1;
+        }
+
+        reap_sends();
+    }
+
+    uint32_t slot_index = free_send_slots.back();
+    free_send_slots.pop_back();
+
+    return (int) slot_index;
+}
 
-    sockaddr_in sender_address;
-    socklen_t address_length = sizeof(sender_address);
+// Sends everything queued. If kernel refuses, sends it didn't take are
+// withdrawn, and their slots are freed, they'd never complete otherwise.
+bool uring_network_impl::submit_sends(unsigned wait_for) {
+    if (!sender.submit(wait_for)) {
+        for (unsigned withdrawn = sender.withdraw(); withdrawn > 0; -- withdrawn) {
+            free_send_slots.push_back(unsubmitted_send_slots.back());
+            unsubmitted_send_slots.pop_back();
+        }
 
-    int received_length = recvfrom(pimpl_->receiving_sock, out_message.data, out_message.size, 0, (struct sockaddr *) &sender_address, &address_length);
-    if (received_length < 0) {
-        // TODO: check if this error or async
         return false;
     }
 
-    if (is_mine_address(sender_address)) {
-        return false; // this is mine message
+    // Kernel takes them in order, ones it didn't take yet are at the end
+    unsubmitted_send_slots.erase(unsubmitted_send_slots.begin(),
+                                 unsubmitted_send_slots.end() - sender.pending());
+    return true;
+}
+
+void uring_network_impl::reap_sends() {
+    for (io_uring_cqe *cqe; (cqe = sender.peek()) != nullptr; sender.consume()) {
+        if (cqe->res < 0) {
+            errno = -cqe->res;
+            perror("Error sending message");
+        }
+
+        free_send_slots.push_back((uint32_t) cqe->user_data);
     }
+}
+
+void uring_network_impl::wait_for_sends() {
+    if (sender.fd() < 0)
+        return;
+
+    reap_sends();
+    while (free_send_slots.size() < SEND_SLOTS && submit_sends(1))
+        reap_sends();
+}
+
+
+uring_network::uring_network(uint16_t port):
+    pimpl_(std::make_shared<uring_network_impl>(port)) {
+}
+
+uring_network::~uring_network() = default;
+
+bool uring_network::is_ready() const {
+    return pimpl_->is_ready;
+}
 
-    std::memcpy(out_sender_addr, &sender_address, sizeof(sockaddr));
+bool uring_network::send(buffer message, address target_addr) {
+    return send_batch(&message, 1, target_addr) == 1;
+}
+
+bool uring_network::broadcast(buffer message) {
+    return broadcast_batch(&message, 1) == 1;
+}
+
+bool uring_network::receive(buffer out_message, address *out_sender_addr) {
+    buffer received = out_message;
+    if (receive_batch(&received, out_sender_addr, 1) != 1)
+        return false;
 
+    // Caller has only this buffer, so it's copied here after all
+    std::memcpy(out_message.data, received.data, received.size);
     return true;
 }
 
-network::~network() {
-    close(pimpl_->receiving_sock);
-    close(pimpl_->broadcast_sock);
-    close(pimpl_->peer2peer_sock);
+size_t uring_network::send_batch(const buffer *messages, size_t count, address target_addr) {
+    sockaddr_in target;
+    std::memcpy(&target, &target_addr, sizeof(target));
+
+    return pimpl_->send(pimpl_->sockets.peer2peer_sock, messages, count, target);
+}
+
+size_t uring_network::broadcast_batch(const buffer *messages, size_t count) {
+    return pimpl_->send(pimpl_->sockets.broadcast_sock, messages, count,
+                        get_broadcast_address(pimpl_->sockets.port));
+}
+
+size_t uring_network::receive_batch(buffer *out_messages, address *out_sender_addrs, size_t count) {
+    // Eventfd is drained first, so that completions that come after
+    // everything was read, signal it again
+    uint64_t completions;
+    while (read(pimpl_->completion_fd, &completions, sizeof(completions)) > 0);
+
+    // Previous batch has been consumed by now
+    for (uint16_t buffer_id: pimpl_->held_buffers)
+        pimpl_->recycle(buffer_id);
+
+    pimpl_->held_buffers.clear();
+    pimpl_->reap_sends();
+
+    size_t received = 0;
+    bool has_restarted = false;
+
+    // Completions are read straight from the shared ring, without syscalls.
+    // Like network, it goes on until the batch is full, or there's nothing
+    // left, even if everything so far was own broadcasts.
+    while (received < count) {
+        io_uring_cqe *cqe = pimpl_->receiver.peek();
+        if (cqe == nullptr) {
+            // Once is enough: if it stops again right away, buffers are held
+            // by this batch, and it's restarted next time, after they're back
+            if (pimpl_->is_receiving || std::exchange(has_restarted, true))
+                break;
+
+            // Buffers have been recycled, so there's room to receive again,
+            // and whatever comes right away still goes to this batch
+            if (!pimpl_->start_receiving()) {
+                fprintf(stderr, "io_uring: couldn't restart receive, nothing will be received\n");
+                pimpl_->is_ready = false;
+                break;
+            }
+
+            continue;
+        }
+
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            pimpl_->is_receiving = false; // It's the last one, receive has to be restarted
+
+        if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+            errno = -cqe->res;
+            perror("io_uring receive");
+        }
+
+        if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+            uint16_t buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            const char *data = pimpl_->buffers.get() + buffer_id * RECEIVE_BUFFER_SIZE;
+
+            // Buffer layout: io_uring_recvmsg_out, sender, payload
+            const io_uring_recvmsg_out *header = (const io_uring_recvmsg_out*) data;
+            size_t payload_offset = sizeof(io_uring_recvmsg_out) + pimpl_->receive_header.msg_namelen;
+
+            sockaddr_in sender_address;
+            std::memcpy(&sender_address, data + sizeof(io_uring_recvmsg_out), sizeof(sender_address));
+
+            // Own broadcasts are skipped, and their buffers go back right away
+            if (header->namelen >= sizeof(sockaddr_in) && !pimpl_->sockets.is_local_address(sender_address)) {
+                size_t size = std::min<size_t>({ header->payloadlen, cqe->res - payload_offset, out_messages[received].size });
+                out_messages[received] = buffer((void*) (data + payload_offset), size);
+
+                pimpl_->sockets.set_reply_port(sender_address);
+                std::memcpy(&out_sender_addrs[received], &sender_address, sizeof(sockaddr_in));
+
+                pimpl_->held_buffers.push_back(buffer_id);
+                ++ received;
+            } else
+                pimpl_->recycle(buffer_id);
+        }
+
+        pimpl_->receiver.consume();
+    }
+
+    // Batch is full, and there's more, so it has to stay readable
+    if (pimpl_->receiver.peek() != nullptr)
+        eventfd_write(pimpl_->completion_fd, 1);
+
+    return received;
+}
+
+int uring_network::receive_fd() const {
+    return pimpl_->completion_fd;
+}
+
+int uring_network::address_change_fd() const {
+    return pimpl_->sockets.netlink_sock;
+}
+
+void uring_network::refresh_local_addresses() {
+    pimpl_->sockets.refresh_local_addresses();
 }
@@ -2,6 +2,7 @@
 
 #include "buffer.h"
 
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <memory>
@@ -47,6 +48,29 @@ public:
     bool broadcast(buffer message);
     bool receive(buffer out_message, address *out_sender_addr);
 
+    // Same as above, but with a syscall per up to MAX_BATCH messages.
+    // Return how many messages were sent, it's `count` unless some failed.
+    size_t send_batch(const buffer *messages, size_t count, address target);
+    size_t broadcast_batch(const buffer *messages, size_t count);
+
+    // Receives up to `count` messages, returns how many were received.
+    // Sizes of received messages are written back to their buffers, and
+    // buffers can get reordered, so that they are the first to be returned.
+    // Other networks may point them at memory of their own instead, which
+    // is valid until the next receive_batch() call.
+    size_t receive_batch(buffer *out_messages, address *out_sender_addrs, size_t count);
+
+    static constexpr size_t MAX_BATCH = 64;
+
+    // Becomes readable when there might be messages to receive
+    int receive_fd() const;
+
+    // Own broadcasts are recognized by addresses of local interfaces. This
+    // becomes readable when they change, and refresh_local_addresses() has
+    // to be called then. It's -1, if changes can't be watched.
+    int address_change_fd() const;
+    void refresh_local_addresses();
+
     network(const network &other) = delete;
     network(const network &&other):
         pimpl_(std::move(other.pimpl_)) {
@@ -58,3 +82,49 @@ private:
     std::shared_ptr<network_impl> pimpl_;
 };
 
+
+struct uring_network_impl;
+
+// Same as network, but on io_uring. A single multishot receive keeps
+// filling buffers the kernel picks from a registered ring, so that while
+// packets keep coming, they are received without any syscalls, and handed
+// out without copying. Batches are sent with a single submission, and
+// sending returns without waiting for them: messages are copied and kept
+// until they're sent. Needs Linux 6.0 or newer: check is_ready() after
+// construction, and fall back to network if it's false. It also turns
+// false later, if receive stops and can't be restarted.
+class uring_network {
+public:
+    uring_network(uint16_t port);
+
+    bool is_ready() const;
+
+    bool send(buffer message, address target);
+    bool broadcast(buffer message);
+    bool receive(buffer out_message, address *out_sender_addr);
+
+    // See network. Sends return how many messages were queued, failures
+    // are reported once they complete. Received buffers point right into
+    // receive buffers, which are taken back on the next receive_batch().
+    size_t send_batch(const buffer *messages, size_t count, address target);
+    size_t broadcast_batch(const buffer *messages, size_t count);
+    size_t receive_batch(buffer *out_messages, address *out_sender_addrs, size_t count);
+
+    // Becomes readable when there are received messages, or sends have
+    // completed, then receive_batch() has to be called to clean them up
+    int receive_fd() const;
+
+    // See network
+    int address_change_fd() const;
+    void refresh_local_addresses();
+
+    uring_network(const uring_network &other) = delete;
+    uring_network(uring_network &&other):
+        pimpl_(std::move(other.pimpl_)) {
+    }
+
+    ~uring_network();
+
+private:
+    std::shared_ptr<uring_network_impl> pimpl_;
+};
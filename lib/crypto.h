@@ -3,11 +3,287 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+
+#include <array>
+#include <bit>
+#include <type_traits>
+#include <vector>
 
 constexpr size_t HASH_SIZE = 8;
 
+// Size of one message block processed by SHA-256 compression function
+constexpr size_t SHA_256_BLOCK_SIZE = 64;
+constexpr size_t SHA_256_BLOCK_WORDS = SHA_256_BLOCK_SIZE / sizeof(uint32_t);
+
+// Initial hash values mandated by the SHA-256 specification
+constexpr uint32_t SHA_256_INITIAL_HASH[HASH_SIZE] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+// Constants mandated by the SHA-256 specification
+constexpr uint32_t SHA_256_ROUND_CONSTANTS[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
 void hash_with_sha_256(const void* const data_ptr,
                        const size_t size,
                        uint32_t output_hash[HASH_SIZE]);
 
+// Runs compression function on one message block with the fastest backend
+// available. First SHA_256_BLOCK_WORDS words of `message` hold the block
+// (as host order words), the rest of it is used as scratch space.
+void compress_with_sha_256(uint32_t message[64],
+                           uint32_t registers[HASH_SIZE]);
+
+// Compression function on one instruction set, same contract as above
+struct sha_256_compressor {
+    const char* name;
+    void (*compress)(uint32_t message[64], uint32_t registers[HASH_SIZE]);
+};
+
+// Backends this CPU supports, from scalar to the fastest one, which is
+// used, if it passes self-test. Rest are for checking against each other.
+std::vector<sha_256_compressor> get_sha_256_compressors();
+
+// Incremental hashing, for messages that come in chunks (e.g. scattered
+// packet buffers). Chunks are never copied together, only the bytes
+// that don't complete a message block are kept in the context.
+struct sha_256_context {
+    uint32_t registers[HASH_SIZE];
+
+    unsigned char pending[SHA_256_BLOCK_SIZE];
+    size_t pending_size;
+
+    uint64_t total_size;
+};
+
+void init_sha_256(sha_256_context* const context);
+
+void update_sha_256(sha_256_context* const context,
+                    const void* const data_ptr,
+                    const size_t size);
+
+void final_sha_256(sha_256_context* const context,
+                   uint32_t output_hash[HASH_SIZE]);
+
+// Hashes contents of a file by mapping it into memory. Returns false,
+// if file couldn't be opened or mapped.
+bool hash_file_with_sha_256(const char* const path,
+                            uint32_t output_hash[HASH_SIZE]);
+
+// Largest number of messages hashed in parallel by a single SIMD kernel
+constexpr size_t SHA_256_MAX_LANES = 16;
+
+// Messages of this size (the size of a block header) get their padding laid
+// out at compile time in every kernel, rest are padded block by block
+constexpr size_t SHA_256_FIXED_BATCH_SIZE = 88;
+
+// Hashes `count` independent messages of equal `size` at once. Messages are
+// spread across SIMD lanes of the widest kernel supported by this CPU (which
+// is selected on startup), falling back to scalar hashing otherwise.
+void hash_with_sha_256_batch(const void* const data_ptrs[],
+                             const size_t size,
+                             const size_t count,
+                             uint32_t output_hashes[][HASH_SIZE]);
+
+// Number of messages hashed per pass by the selected kernel (1 for scalar)
+size_t sha_256_batch_lanes();
+
+// Hashes exactly `lanes` messages of equal size with one instruction set
+struct sha_256_batch_kernel {
+    const char* name;
+    size_t lanes;
+
+    void (*hash)(const void* const data_ptrs[],
+                 const size_t size,
+                 uint32_t output_hashes[][HASH_SIZE]);
+};
+
+// Kernels this CPU supports, from scalar to the widest one, which is the
+// one hash_with_sha_256_batch uses, unless it fails its self-test on first
+// use. Rest are for checking against each other.
+std::vector<sha_256_batch_kernel> get_sha_256_batch_kernels();
+
+
+// ================ FIXED SIZE MESSAGES ================
+
+// When size of the message is known at compile time, so is the padding:
+// it's laid out once, and only the data bytes get copied on each hash.
+template <size_t size>
+struct sha_256_fixed_layout {
+    static constexpr size_t full_blocks = size / SHA_256_BLOCK_SIZE;
+    static constexpr size_t tail_size = size % SHA_256_BLOCK_SIZE;
+
+    // Padding starts with a single '1' bit, and ends with 64-bit size:
+    static constexpr size_t tail_blocks =
+        tail_size + 1 + sizeof(uint64_t) <= SHA_256_BLOCK_SIZE ? 1 : 2;
+
+    static constexpr size_t total_blocks = full_blocks + tail_blocks;
+
+    static constexpr std::array<unsigned char, tail_blocks * SHA_256_BLOCK_SIZE> padding = [] {
+        std::array<unsigned char, tail_blocks * SHA_256_BLOCK_SIZE> padding {};
+        padding[tail_size] = 0x80;
+
+        const uint64_t size_in_bits = (uint64_t) size * 8;
+        for (size_t i = 0; i < sizeof(uint64_t); ++ i)
+            padding[padding.size() - 1 - i] = (unsigned char) (size_in_bits >> (8 * i));
+
+        return padding;
+    }();
+};
+
+inline void load_sha_256_block(const unsigned char* bytes, uint32_t message[64]) {
+    memcpy(message, bytes, SHA_256_BLOCK_SIZE);
+
+    if constexpr (std::endian::native == std::endian::little)
+        for (size_t i = 0; i < SHA_256_BLOCK_WORDS; ++ i)
+            message[i] = __builtin_bswap32(message[i]);
+}
+
+// Continues hashing of a message with compile-time known `size`, whose
+// first `skip_blocks` blocks are already compressed into `registers`.
+template <size_t size, size_t skip_blocks = 0>
+inline void finish_sha_256(const void* const data_ptr,
+                           uint32_t registers[HASH_SIZE]) {
+
+    using layout = sha_256_fixed_layout<size>;
+    static_assert(skip_blocks <= layout::full_blocks);
+
+    const unsigned char* data = (const unsigned char*) data_ptr;
+    uint32_t message[64];
+
+    for (size_t i = skip_blocks; i < layout::full_blocks; ++ i) {
+        load_sha_256_block(data + i * SHA_256_BLOCK_SIZE, message);
+        compress_with_sha_256(message, registers);
+    }
+
+    std::array<unsigned char, layout::padding.size()> tail = layout::padding;
+    memcpy(tail.data(), data + layout::full_blocks * SHA_256_BLOCK_SIZE, layout::tail_size);
+
+    for (size_t i = 0; i < layout::tail_blocks; ++ i) {
+        load_sha_256_block(tail.data() + i * SHA_256_BLOCK_SIZE, message);
+        compress_with_sha_256(message, registers);
+    }
+}
+
+// Compresses first `blocks` message blocks of data. Result (midstate) can
+// be passed to finish_sha_256 to hash many messages sharing this prefix.
+template <size_t blocks>
+inline void start_sha_256(const void* const data_ptr,
+                          uint32_t registers[HASH_SIZE]) {
+
+    const unsigned char* data = (const unsigned char*) data_ptr;
+    uint32_t message[64];
+
+    memcpy(registers, SHA_256_INITIAL_HASH, sizeof(SHA_256_INITIAL_HASH));
+    for (size_t i = 0; i < blocks; ++ i) {
+        load_sha_256_block(data + i * SHA_256_BLOCK_SIZE, message);
+        compress_with_sha_256(message, registers);
+    }
+}
+
+template <size_t size>
+inline void hash_with_sha_256(const void* const data_ptr,
+                              uint32_t output_hash[HASH_SIZE]) {
+
+    memcpy(output_hash, SHA_256_INITIAL_HASH, sizeof(SHA_256_INITIAL_HASH));
+    finish_sha_256<size>(data_ptr, output_hash);
+}
+
+
+// ================ COMPILE TIME ================
+
+// Straightforward implementation, that can be run in constant evaluation,
+// so that hashes embedded in the binary are checked when it's compiled.
+// It's never used at runtime, compress_with_sha_256 is much faster.
+constexpr void compress_with_sha_256_at_compile_time(uint32_t message[64],
+                                                     uint32_t registers[HASH_SIZE]) {
+
+    for (size_t i = SHA_256_BLOCK_WORDS; i < 64; ++ i) {
+        uint32_t s0 = std::rotr(message[i - 15],  7) ^ std::rotr(message[i - 15], 18) ^ (message[i - 15] >>  3);
+        uint32_t s1 = std::rotr(message[i -  2], 17) ^ std::rotr(message[i -  2], 19) ^ (message[i -  2] >> 10);
+
+        message[i] = message[i - 16] + s0 + message[i - 7] + s1;
+    }
+
+    uint32_t state[HASH_SIZE] = {};
+    for (size_t i = 0; i < HASH_SIZE; ++ i)
+        state[i] = registers[i];
+
+    for (size_t i = 0; i < 64; ++ i) {
+        auto [a, b, c, d, e, f, g, h] = state;
+
+        uint32_t t1 = h + (std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25))
+                        + ((e & f) ^ (~ e & g)) + SHA_256_ROUND_CONSTANTS[i] + message[i];
+
+        uint32_t t2 = (std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22))
+                    + ((a & b) ^ (a & c) ^ (b & c));
+
+        uint32_t next[HASH_SIZE] = { t1 + t2, a, b, c, d + t1, e, f, g };
+        for (size_t j = 0; j < HASH_SIZE; ++ j)
+            state[j] = next[j];
+    }
+
+    for (size_t i = 0; i < HASH_SIZE; ++ i)
+        registers[i] += state[i];
+}
+
+template <size_t size>
+constexpr void hash_with_sha_256_at_compile_time(const std::array<unsigned char, size> &data,
+                                                 uint32_t output_hash[HASH_SIZE]) {
+
+    using layout = sha_256_fixed_layout<size>;
+    constexpr size_t tail_offset = layout::full_blocks * SHA_256_BLOCK_SIZE;
+
+    for (size_t i = 0; i < HASH_SIZE; ++ i)
+        output_hash[i] = SHA_256_INITIAL_HASH[i];
+
+    for (size_t block = 0; block < layout::total_blocks; ++ block) {
+        uint32_t message[64] = {};
+
+        for (size_t i = 0; i < SHA_256_BLOCK_SIZE; ++ i) {
+            size_t offset = block * SHA_256_BLOCK_SIZE + i;
+            unsigned char byte = offset < size ? data[offset] : layout::padding[offset - tail_offset];
+
+            message[i / sizeof(uint32_t)] |= uint32_t(byte) << (8 * (3 - i % sizeof(uint32_t)));
+        }
+
+        compress_with_sha_256_at_compile_time(message, output_hash);
+    }
+}
+
+// Hashes object representation of fixed-size types, like block headers.
+// Works in constant evaluation too (if type can be bit_cast), so
+// hashes of constants can be checked with static_assert.
+template <typename type>
+    requires std::is_trivially_copyable_v<type> && (!std::is_pointer_v<type>)
+constexpr void hash_with_sha_256(const type &object,
+                                 uint32_t output_hash[HASH_SIZE]) {
+
+    if (std::is_constant_evaluated()) {
+        auto bytes = std::bit_cast<std::array<unsigned char, sizeof(type)>>(object);
+        hash_with_sha_256_at_compile_time(bytes, output_hash);
+        return;
+    }
+
+    hash_with_sha_256<sizeof(type)>(&object, output_hash);
+}
+
 #endif
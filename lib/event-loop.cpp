@@ -0,0 +1,183 @@
+#include "event-loop.h"
+
+#include <algorithm>
+#include <cstring>
+#include <errno.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+
+namespace {
+
+constexpr size_t MAX_EVENTS = 16;
+
+itimerspec get_timer_spec(std::chrono::milliseconds interval) {
+    timespec period = {
+        .tv_sec = interval.count() / 1000,
+        .tv_nsec = interval.count() % 1000 * 1000000
+    };
+
+    return { .it_interval = period, .it_value = period };
+}
+
+} // end anonymous namespace
+
+
+event_loop::event_loop():
+    epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+    owned_fds_(),
+    num_owned_fds_(0) {
+
+    if (epoll_fd_ < 0)
+        perror("epoll_create1");
+}
+
+event_loop::~event_loop() {
+    for (size_t i = 0; i < num_owned_fds_; ++ i)
+        close(owned_fds_[i]);
+
+    if (epoll_fd_ >= 0)
+        close(epoll_fd_);
+}
+
+int event_loop::own(int fd) {
+    if (num_owned_fds_ == MAX_OWNED_FDS) {
+        fprintf(stderr, "event loop: too many owned descriptors\n");
+        close(fd);
+
+        return -1;
+    }
+
+    owned_fds_[num_owned_fds_ ++] = fd;
+    return fd;
+}
+
+bool event_loop::watch(int fd, uint32_t source) {
+    epoll_event event = { .events = EPOLLIN, .data = { .u32 = source } };
+
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+        perror("epoll_ctl");
+        return false;
+    }
+
+    return true;
+}
+
+int event_loop::add_timer(std::chrono::milliseconds interval, uint32_t source) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        perror("timerfd_create");
+        return -1;
+    }
+
+    if (own(fd) < 0)
+        return -1;
+
+    if (!restart_timer(fd, interval) || !watch(fd, source))
+        return -1;
+
+    return fd;
+}
+
+bool event_loop::restart_timer(int timer_fd, std::chrono::milliseconds interval) {
+    itimerspec spec = get_timer_spec(interval);
+
+    if (timerfd_settime(timer_fd, 0, &spec, nullptr) < 0) {
+        perror("timerfd_settime");
+        return false;
+    }
+
+    return true;
+}
+
+int event_loop::add_directory_watch(const char *directory, uint32_t source) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        perror("inotify_init1");
+        return -1;
+    }
+
+    if (own(fd) < 0)
+        return -1;
+
+    if (inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        perror("inotify_add_watch");
+        return -1;
+    }
+
+    if (!watch(fd, source))
+        return -1;
+
+    return fd;
+}
+
+int event_loop::add_notifier(uint32_t source) {
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        perror("eventfd");
+        return -1;
+    }
+
+    if (own(fd) < 0 || !watch(fd, source))
+        return -1;
+
+    return fd;
+}
+
+bool event_loop::notify(int notifier_fd) {
+    if (eventfd_write(notifier_fd, 1) < 0) {
+        perror("eventfd_write");
+        return false;
+    }
+
+    return true;
+}
+
+bool event_loop::has_file_changed(int watch_fd, const char *name) {
+    bool changed = false;
+
+    alignas(inotify_event) char events[4096];
+    while (true) {
+        ssize_t length = read(watch_fd, events, sizeof(events));
+        if (length <= 0)
+            return changed;
+
+        for (ssize_t offset = 0; offset < length; ) {
+            const inotify_event *event = (const inotify_event*) (events + offset);
+            if (event->len > 0 && strcmp(event->name, name) == 0)
+                changed = true;
+
+            offset += sizeof(inotify_event) + event->len;
+        }
+    }
+}
+
+void event_loop::drain(int fd) {
+    // Much more than eventfd and timerfd counters take
+    char discarded[4096];
+    while (read(fd, discarded, sizeof(discarded)) > 0);
+}
+
+size_t event_loop::wait(uint32_t *out_sources, size_t max_count) {
+    epoll_event events[MAX_EVENTS];
+
+    while (true) {
+        int count = epoll_wait(epoll_fd_, events, std::min(max_count, MAX_EVENTS), -1);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+
+            perror("epoll_wait");
+            return 0;
+        }
+
+        for (int i = 0; i < count; ++ i)
+            out_sources[i] = events[i].data.u32;
+
+        return count;
+    }
+}
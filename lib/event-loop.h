@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+
+// Sleeps until one of the watched file descriptors becomes readable, so that
+// the owner reacts to messages, timers and such right away, without polling.
+// Every descriptor is registered with a `source` tag, that's reported back
+// when it's ready. Watches are level triggered: descriptor has to be drained,
+// or it's going to be reported again.
+class event_loop {
+public:
+    event_loop();
+    ~event_loop();
+
+    event_loop(const event_loop &other) = delete;
+    event_loop& operator=(const event_loop &other) = delete;
+
+    bool watch(int fd, uint32_t source);
+
+    // Creates timer that fires every `interval`, and watches it. Returns
+    // timer's descriptor, which is owned by the loop, or -1 on failure.
+    int add_timer(std::chrono::milliseconds interval, uint32_t source);
+
+    // Timer fires next time a whole `interval` from now
+    static bool restart_timer(int timer_fd, std::chrono::milliseconds interval);
+
+    // Watches files getting written to, or moved into `directory`. Returns
+    // watch's descriptor, which is owned by the loop, or -1 on failure.
+    int add_directory_watch(const char *directory, uint32_t source);
+
+    // Creates eventfd that other threads wake the loop with, and watches
+    // it. Returns its descriptor, which is owned by the loop, or -1.
+    int add_notifier(uint32_t source);
+
+    // Makes notifier readable, can be called from any thread
+    static bool notify(int notifier_fd);
+
+    // Drains watch, returns true if file `name` has changed since last time
+    static bool has_file_changed(int watch_fd, const char *name);
+
+    // Reads everything from non-blocking `fd`, and throws it away
+    static void drain(int fd);
+
+    // Waits until at least one of watched descriptors is readable, writes
+    // their sources to `out_sources`. Returns 0 if loop is broken.
+    size_t wait(uint32_t *out_sources, size_t max_count);
+
+private:
+    static constexpr size_t MAX_OWNED_FDS = 8;
+
+    int epoll_fd_;
+
+    int owned_fds_[MAX_OWNED_FDS];
+    size_t num_owned_fds_;
+
+    int own(int fd);
+};
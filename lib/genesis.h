@@ -0,0 +1,28 @@
+#pragma once
+
+#include "block.h"
+
+
+// First block of every chain, same for all nodes, so that their chains can
+// join. It was signed once, offline, and is checked when the node is compiled.
+constexpr block GENESIS_BLOCK {
+    .version = BLOCK_VERSION,
+    .previous_hash = {},
+    .data = {},
+    .reserved = {},
+    .pow_signature = 3750996,
+    .pow_extra_signature = 0,
+    .timestamp = 1792108800000, // 2026-10-16 00:00:00 UTC
+    .proof_order = PROOF_ORDER,
+    .reserved_suffix = {}
+};
+
+constexpr hash256_t GENESIS_HASH = {
+    0x8e000000, 0x1ba5813d, 0x0a519a5a, 0x4fe007bf,
+    0x704b8352, 0xb74f72ae, 0x50ba28d6, 0x95a838fe
+};
+
+static_assert(GENESIS_BLOCK.calculate_hash() == GENESIS_HASH, "Genesis block doesn't match its hash");
+static_assert(GENESIS_BLOCK.verify(), "Genesis block isn't signed");
+
+constexpr hashed_block HASHED_GENESIS_BLOCK { GENESIS_BLOCK, GENESIS_HASH };
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "block.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+
+// Open addressing table keyed by SHA-256 hashes. Slots are split into
+// groups of 16, each group has a control byte per slot, holding either
+// EMPTY or 7 bits of the key's hash, so a whole group is checked with a
+// single vector comparison before any key gets touched.
+//
+// Keys are already uniformly distributed, so their words are used as the
+// hash directly. Leading words are skipped though: they carry zero bits
+// of the proof of work. Erased entries leave tombstones behind, so that
+// probes go on past them, and they are reused by insertions.
+template <typename value_type>
+class hash256_map {
+public:
+    hash256_map():
+        controls_(),
+        keys_(),
+        values_(),
+        size_(0),
+        tombstones_(0) {
+    }
+
+    value_type *find(const hash256_t &key) {
+        size_t slot = find_slot(key);
+        return slot == NOT_FOUND ? nullptr : &values_[slot];
+    }
+
+    const value_type *find(const hash256_t &key) const {
+        size_t slot = find_slot(key);
+        return slot == NOT_FOUND ? nullptr : &values_[slot];
+    }
+
+    bool contains(const hash256_t &key) const {
+        return find_slot(key) != NOT_FOUND;
+    }
+
+    // Returns false, and leaves the table as is, if key is already there
+    bool insert(const hash256_t &key, const value_type &value) {
+        if (contains(key))
+            return false;
+
+        // Keep at least 1/8 of slots empty, so that probes stay short. If
+        // it's mostly tombstones that fill them, they are just cleared:
+        if ((size_ + tombstones_ + 1) * 8 > capacity() * 7) {
+            size_t groups = (size_ + 1) * 2 > capacity() ? controls_.size() * 2 : controls_.size();
+            rehash(std::max<size_t>(groups, MIN_GROUPS));
+        }
+
+        place(key, value);
+        ++ size_;
+
+        return true;
+    }
+
+    // Returns false, if there's no such key
+    bool erase(const hash256_t &key) {
+        size_t slot = find_slot(key);
+        if (slot == NOT_FOUND)
+            return false;
+
+        controls_[slot / GROUP_SIZE][slot % GROUP_SIZE] = DELETED;
+        -- size_, ++ tombstones_;
+
+        return true;
+    }
+
+    size_t size() const { return size_; }
+    size_t capacity() const { return controls_.size() * GROUP_SIZE; }
+
+    // Slots of erased keys, that are neither reused, nor cleared by rehash yet
+    size_t tombstones() const { return tombstones_; }
+
+private:
+    static constexpr size_t GROUP_SIZE = 16;
+    static constexpr size_t MIN_GROUPS = 2;
+
+    // Tags are 7 bits, so they never look like either of these
+    static constexpr int8_t EMPTY = -128;
+    static constexpr int8_t DELETED = -1;
+
+    static constexpr size_t NOT_FOUND = SIZE_MAX;
+
+    typedef int8_t control_group __attribute__((vector_size(GROUP_SIZE)));
+
+    std::vector<control_group> controls_;
+    std::vector<hash256_t> keys_;
+    std::vector<value_type> values_;
+
+    size_t size_;
+    size_t tombstones_;
+
+    static uint64_t get_hash(const hash256_t &key) {
+        return (uint64_t(key[7]) << 32) | key[6];
+    }
+
+    static int8_t get_tag(const hash256_t &key) {
+        return key[5] & 0x7F;
+    }
+
+    // Bit mask of slots in the group, whose control bytes equal `value`
+    static uint32_t match(const control_group &group, int8_t value) {
+        control_group equal = group == (control_group{} + value);
+
+#if defined(__SSE2__)
+        return _mm_movemask_epi8((__m128i) equal);
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_SIZE; ++ i)
+            mask |= uint32_t(equal[i] & 1) << i;
+
+        return mask;
+#endif
+    }
+
+    size_t find_slot(const hash256_t &key) const {
+        if (size_ == 0)
+            return NOT_FOUND;
+
+        int8_t tag = get_tag(key);
+
+        // Triangular probing visits every group, when there's a power of two of them:
+        size_t group_mask = controls_.size() - 1;
+        for (size_t group = get_hash(key) & group_mask, step = 1; ; group = (group + step ++) & group_mask) {
+            for (uint32_t matches = match(controls_[group], tag); matches != 0; matches &= matches - 1) {
+                size_t slot = group * GROUP_SIZE + __builtin_ctz(matches);
+                if (keys_[slot] == key)
+                    return slot;
+            }
+
+            // Key would've been put in this group, if it wasn't full:
+            if (match(controls_[group], EMPTY) != 0)
+                return NOT_FOUND;
+        }
+    }
+
+    // Puts key in the first empty or erased slot of its probe sequence
+    void place(const hash256_t &key, const value_type &value) {
+        size_t group_mask = controls_.size() - 1;
+        for (size_t group = get_hash(key) & group_mask, step = 1; ; group = (group + step ++) & group_mask) {
+            uint32_t deleted = match(controls_[group], DELETED);
+            uint32_t free = match(controls_[group], EMPTY) | deleted;
+            if (free == 0)
+                continue;
+
+            size_t index = __builtin_ctz(free);
+            if (deleted & (1u << index))
+                -- tombstones_;
+
+            controls_[group][index] = get_tag(key);
+
+            size_t slot = group * GROUP_SIZE + index;
+            keys_[slot] = key;
+            values_[slot] = value;
+            return;
+        }
+    }
+
+    void rehash(size_t groups) {
+        std::vector<control_group> old_controls = std::move(controls_);
+        std::vector<hash256_t> old_keys = std::move(keys_);
+        std::vector<value_type> old_values = std::move(values_);
+
+        controls_.assign(groups, control_group{} + EMPTY);
+        keys_.resize(groups * GROUP_SIZE);
+        values_.resize(groups * GROUP_SIZE);
+        tombstones_ = 0;
+
+        for (size_t group = 0; group < old_controls.size(); ++ group)
+            for (size_t index = 0; index < GROUP_SIZE; ++ index)
+                if (old_controls[group][index] >= 0) {
+                    size_t slot = group * GROUP_SIZE + index;
+                    place(old_keys[slot], old_values[slot]);
+                }
+    }
+};
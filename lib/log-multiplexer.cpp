@@ -196,7 +196,8 @@ log_multiplexer::~log_multiplexer() {
 
 void log_multiplexer::create_pane(int pane_id, std::string name, pane::its_mode mode,
                                   std::unique_ptr<pane_controller> controller) {
-    // TODO: lock?
+    std::lock_guard<std::mutex> lock(mutex_);
+
     auto [i, added] = panes_.emplace(pane_id, pane{std::move(name), mode, std::move(controller)});
     if (added) {
         auto &[_, pane] = *i;
@@ -208,11 +209,18 @@ void log_multiplexer::create_pane(int pane_id, std::string name, pane::its_mode
 
 void log_multiplexer::run() {
     while (true) {
+        keybinding pressed = read_keybinding();
+        if (pressed == kbd("q"))
+            return;
+
         int rows, cols;
         get_terminal_size(&rows, &cols);
 
         -- rows;
 
+        // Other threads keep appending to panes, while keys are handled
+        std::unique_lock<std::mutex> lock(mutex_);
+
         pane &current = panes_.at(current_);
         int &hscroll = current.hscroll, &vscroll = current.vscroll;
 
@@ -225,7 +233,6 @@ void log_multiplexer::run() {
 
         bool should_redraw = true;
 
-        keybinding pressed = read_keybinding();
         switch (pressed) {
         case kbd(      "H"): current_ --;                                   break;
         case kbd(      "L"): current_ ++;                                   break;
@@ -294,11 +301,13 @@ void log_multiplexer::run() {
             }
         }
 
+        lock.unlock();
         redraw();
     }
 }
 
 void log_multiplexer::assign(int log_id, const std::string &message) {
+    bool is_shown;
     {
         std::lock_guard<std::mutex> lock(mutex_);
 
@@ -306,19 +315,24 @@ void log_multiplexer::assign(int log_id, const std::string &message) {
 
         current.data.lines.clear();
         split_line(current.data.lines, message);
+
+        is_shown = log_id == current_;
     }
 
-    if (log_id == current_)
+    if (is_shown)
         redraw();
 }
 
 void log_multiplexer::append(int log_id, const std::string &message) {
+    bool is_shown;
     {
         std::lock_guard<std::mutex> lock(mutex_);
         split_line(panes_.at(log_id).data.lines, message);
+
+        is_shown = log_id == current_;
     }
 
-    if (log_id == current_)
+    if (is_shown)
         redraw();
 }
 
@@ -329,10 +343,10 @@ void log_multiplexer::redraw() {
     if (rows == 0 || cols == 0)
         return;
 
+    std::lock_guard<std::mutex> lock(mutex_);
     pane &current = panes_.at(current_);
 
     {
-        std::lock_guard<std::mutex> lock(mutex_);
         printf(RESET_SCREEN);
 
         bool follow = current.vscroll == VSCROLL_FOLLOW && current.mode == pane::LOG;
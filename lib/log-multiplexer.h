@@ -67,7 +67,9 @@ public:
     void create_pane(int pane_id, std::string name, pane::its_mode mode,
                      std::unique_ptr<pane_controller> controller = nullptr);
 
+    // Handles keys on the calling thread, returns once 'q' is pressed
     void run();
+
     void assign(int pane_id, const std::string &message);
     void append(int pane_id, const std::string &message);
 
@@ -0,0 +1,328 @@
+#include "miner.h"
+
+#include <algorithm>
+#include <bit>
+#include <format>
+#include <limits>
+#include <utility>
+
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+
+namespace {
+
+// Number of signatures a worker takes at once, small enough that
+// workers notice quickly that job got cancelled or solved
+constexpr uint64_t RANGE_SIZE = 1 << 16;
+
+// Ranges in the space of a single pow_extra_signature value, and in total:
+constexpr uint64_t NUM_SIGNATURE_RANGES = (uint64_t(std::numeric_limits<uint32_t>::max()) + 1) / RANGE_SIZE;
+constexpr uint64_t NUM_RANGES = NUM_SIGNATURE_RANGES * (uint64_t(std::numeric_limits<uint32_t>::max()) + 1);
+
+using clock = std::chrono::steady_clock;
+
+clock::time_point get_deadline(std::chrono::milliseconds timeout) {
+    auto now = clock::now();
+    if (timeout >= std::chrono::duration_cast<std::chrono::milliseconds>(clock::time_point::max() - now))
+        return clock::time_point::max(); // Would overflow, so there's no deadline at all
+
+    return now + timeout;
+}
+
+void notify_completion(int completion_fd) {
+    if (completion_fd >= 0)
+        eventfd_write(completion_fd, 1);
+}
+
+} // end anonymous namespace
+
+
+double mining_stats::thread_stats::hashes_per_second() const {
+    if (busy_time.count() == 0)
+        return 0;
+
+    return hashes / std::chrono::duration<double>(busy_time).count();
+}
+
+double mining_stats::hashes_per_second() const {
+    double total = 0;
+    for (const thread_stats &thread: threads)
+        total += thread.hashes_per_second();
+
+    return total;
+}
+
+std::string describe_mining_stats(const mining_stats &stats) {
+    std::string description;
+
+    uint64_t hashes = 0, wasted = 0;
+    for (const auto &thread: stats.threads)
+        hashes += thread.hashes, wasted += thread.wasted_hashes;
+
+    description += std::format("hashrate: {:.2f} MH/s, jobs solved: {}, cancelled: {}\n",
+                               stats.hashes_per_second() / 1e6, stats.jobs_solved, stats.jobs_cancelled);
+    description += std::format("hashes: {}, wasted on replaced blocks: {} ({:.1f}%)\n\n",
+                               hashes, wasted, hashes == 0 ? 0.0 : 100.0 * wasted / hashes);
+
+    for (size_t i = 0; i < stats.threads.size(); ++ i) {
+        const auto &thread = stats.threads[i];
+        description += std::format("thread {:>3}: {:>8.2f} MH/s, solutions: {}, hashes: {}, wasted: {}\n",
+                                   i, thread.hashes_per_second() / 1e6, thread.solutions,
+                                   thread.hashes, thread.wasted_hashes);
+    }
+
+    description += "\ntime to solution:\n";
+    for (size_t i = 0; i < stats.time_to_solution.size(); ++ i) {
+        if (stats.time_to_solution[i] == 0)
+            continue;
+
+        description += std::format("  < {:>7} ms: {}\n", uint64_t(1) << (i + 1), stats.time_to_solution[i]);
+    }
+
+    return description;
+}
+
+
+miner::miner(unsigned num_threads):
+    num_threads_(num_threads == 0 ? 1 : num_threads),
+    completion_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    counters_(std::make_unique<thread_counters[]>(num_threads_)) {
+
+    if (completion_fd_ < 0)
+        perror("eventfd");
+
+    for (unsigned i = 0; i < num_threads_; ++ i)
+        workers_.emplace_back([this, i] { serve(i); });
+}
+
+miner::~miner() {
+    cancel();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        should_exit_ = true;
+    }
+
+    started_.notify_all();
+    workers_.clear(); // Joins all of them
+
+    if (completion_fd_ >= 0)
+        close(completion_fd_);
+}
+
+void miner::serve(unsigned worker) {
+    uint64_t seen_generation = 0;
+
+    while (true) {
+        job* current;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            started_.wait(lock, [&] { return should_exit_ || generation_ != seen_generation; });
+
+            if (should_exit_)
+                return;
+
+            seen_generation = generation_;
+            current = job_.get();
+        }
+
+        work(*current, worker, counters_[worker]);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            -- busy_workers_;
+        }
+
+        finished_.notify_one();
+    }
+}
+
+void miner::work(job &current, unsigned worker, thread_counters &counters) {
+    block attempt = current.candidate;
+    uint64_t hashes = 0;
+
+    auto now = clock::now();
+
+    while (!current.should_stop.load(std::memory_order_relaxed)) {
+        uint64_t range = current.next_range.fetch_add(1, std::memory_order_relaxed);
+        if (range >= NUM_RANGES || now >= current.deadline) {
+            if (!current.should_stop.exchange(true)) // Out of signatures or time
+                notify_completion(current.completion_fd);
+
+            break;
+        }
+
+        // Both signatures are in the suffix, so the midstate stays the same:
+        attempt.pow_extra_signature = static_cast<uint32_t>(range / NUM_SIGNATURE_RANGES);
+
+        uint64_t first = range % NUM_SIGNATURE_RANGES * RANGE_SIZE, i = first;
+        for (; i < first + RANGE_SIZE; ++ i) {
+            attempt.pow_signature = static_cast<uint32_t>(i);
+
+            if (block::is_signed_hash(attempt.calculate_hash(current.midstate), attempt.proof_order))
+                break;
+        }
+
+        uint64_t range_hashes = std::min(i + 1, first + RANGE_SIZE) - first;
+        counters.hashes.fetch_add(range_hashes, std::memory_order_relaxed);
+        hashes += range_hashes;
+
+        auto range_started = std::exchange(now, clock::now());
+        auto busy = std::chrono::duration_cast<std::chrono::nanoseconds>(now - range_started);
+        counters.busy_nanoseconds.fetch_add(busy.count(), std::memory_order_relaxed);
+
+        if (i == first + RANGE_SIZE)
+            continue; // Whole range is tried, no luck
+
+        if (!current.is_signed.exchange(true)) {
+            current.signature = attempt.pow_signature;
+            current.extra_signature = attempt.pow_extra_signature;
+
+            counters.solutions.fetch_add(1, std::memory_order_relaxed);
+
+            auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(now - current.started).count();
+            size_t bucket = milliseconds <= 1 ? 0 : std::bit_width(uint64_t(milliseconds)) - 1;
+            counters.time_to_solution[std::min(bucket, mining_stats::NUM_HISTOGRAM_BUCKETS - 1)]
+                .fetch_add(1, std::memory_order_relaxed);
+
+            // Whoever wakes up on the notification must see the job finished
+            current.should_stop = true;
+            notify_completion(current.completion_fd);
+        }
+
+        current.should_stop = true;
+        break;
+    }
+
+    current.hashes[worker] += hashes;
+}
+
+void miner::join() {
+    // Job stays alive until then, workers hold a reference to it
+    std::unique_lock<std::mutex> lock(mutex_);
+    finished_.wait(lock, [&] { return busy_workers_ == 0; });
+}
+
+void miner::start(const block &candidate, std::chrono::milliseconds timeout) {
+    cancel();
+
+    job_ = std::make_unique<job>();
+    job_->candidate = candidate;
+    job_->hashes.resize(num_threads_);
+    job_->completion_fd = completion_fd_;
+
+    job_->started = clock::now();
+    job_->deadline = get_deadline(timeout);
+
+    // Prefix of the block doesn't change between attempts:
+    job_->midstate = candidate.calculate_midstate();
+
+    wake();
+}
+
+void miner::wake() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        busy_workers_ = num_threads_;
+        ++ generation_;
+    }
+
+    started_.notify_all();
+}
+
+void miner::cancel(cancel_reason reason) {
+    if (!job_)
+        return;
+
+    job_->should_stop = true;
+    join();
+
+    if (!job_->is_signed) {
+        // Everything done for this job is thrown away, but it's only a
+        // waste, if the block would've been useless even if it got signed
+        if (reason == cancel_reason::BLOCK_REPLACED)
+            for (unsigned i = 0; i < num_threads_; ++ i)
+                counters_[i].wasted_hashes.fetch_add(job_->hashes[i], std::memory_order_relaxed);
+
+        ++ jobs_cancelled_;
+    }
+
+    job_ = nullptr;
+}
+
+void miner::pause() {
+    if (!is_running())
+        return;
+
+    job_->should_stop = true;
+    join();
+
+    // Ranges below next_range are all tried by now, unless it got signed
+    // or ran out of signatures in the meantime, then it's just finished
+    if (!job_->is_signed && job_->next_range < NUM_RANGES) {
+        job_->is_paused = true;
+        job_->paused = clock::now();
+    }
+}
+
+void miner::resume() {
+    if (!job_ || !job_->is_paused)
+        return;
+
+    // Time spent paused doesn't count towards the timeout
+    if (job_->deadline != clock::time_point::max())
+        job_->deadline += clock::now() - job_->paused;
+
+    job_->is_paused = false;
+    job_->should_stop = false;
+
+    wake();
+}
+
+std::optional<block> miner::poll() {
+    if (!job_ || !job_->is_signed)
+        return std::nullopt;
+
+    join(); // Others have already been told to stop
+    ++ jobs_solved_;
+
+    block signed_block = job_->candidate;
+    signed_block.pow_signature = job_->signature;
+    signed_block.pow_extra_signature = job_->extra_signature;
+
+    job_ = nullptr;
+    return signed_block;
+}
+
+bool miner::is_running() const {
+    return job_ && !job_->should_stop;
+}
+
+mining_stats miner::stats() const {
+    mining_stats stats {};
+
+    for (unsigned i = 0; i < num_threads_; ++ i) {
+        const thread_counters &counters = counters_[i];
+
+        stats.threads.push_back({
+            .hashes        = counters.hashes.load(std::memory_order_relaxed),
+            .solutions     = counters.solutions.load(std::memory_order_relaxed),
+            .wasted_hashes = counters.wasted_hashes.load(std::memory_order_relaxed),
+            .busy_time     = std::chrono::nanoseconds(counters.busy_nanoseconds.load(std::memory_order_relaxed)),
+            .time_to_solution = {}
+        });
+
+        mining_stats::histogram &histogram = stats.threads.back().time_to_solution;
+        for (size_t j = 0; j < histogram.size(); ++ j) {
+            histogram[j] = counters.time_to_solution[j].load(std::memory_order_relaxed);
+            stats.time_to_solution[j] += histogram[j];
+        }
+    }
+
+    stats.jobs_solved = jobs_solved_;
+    stats.jobs_cancelled = jobs_cancelled_;
+
+    return stats;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "block.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Snapshot of mining counters, accumulated over the whole life of a miner
+struct mining_stats {
+    // Bucket i counts jobs solved in [2^i, 2^(i+1)) milliseconds,
+    // first and last buckets also include everything faster/slower.
+    static constexpr size_t NUM_HISTOGRAM_BUCKETS = 20;
+    using histogram = std::array<uint64_t, NUM_HISTOGRAM_BUCKETS>;
+
+    struct thread_stats {
+        uint64_t hashes;
+        uint64_t solutions;
+        uint64_t wasted_hashes; // Spent on blocks that got replaced
+        std::chrono::nanoseconds busy_time;
+
+        histogram time_to_solution; // Of jobs this thread solved
+
+        double hashes_per_second() const;
+    };
+
+    std::vector<thread_stats> threads;
+
+    // Merged from all threads
+    histogram time_to_solution;
+
+    uint64_t jobs_solved, jobs_cancelled;
+
+    double hashes_per_second() const;
+};
+
+std::string describe_mining_stats(const mining_stats &stats);
+
+
+// Searches for block signatures on a pool of worker threads in the
+// background. Signatures are enumerated deterministically: the 32-bit space
+// of pow_signature is split into fixed ranges that workers take one at a
+// time, and once it's exhausted, pow_extra_signature is incremented and
+// the space is walked again. So no signature is ever tried twice.
+// Threads are started once, and sleep between jobs, like in worker_pool.
+class miner {
+public:
+    explicit miner(unsigned num_threads);
+    ~miner();
+
+    miner(const miner &other) = delete;
+    miner& operator=(const miner &other) = delete;
+
+    // Starts looking for a signature of `candidate`, cancelling current job
+    void start(const block &candidate,
+               std::chrono::milliseconds timeout = std::chrono::milliseconds::max());
+
+    enum class cancel_reason {
+        STOPPED,       // Timed out, superseded by another job, or miner is done
+        BLOCK_REPLACED // Block with the same parent got linked before it was signed
+    };
+
+    // Stops current job as soon as workers finish ranges they're on. Hashes
+    // done for it are counted as wasted, only if its block got replaced.
+    void cancel(cancel_reason reason = cancel_reason::STOPPED);
+
+    // Stops current job as soon as workers finish ranges they're on, but
+    // keeps it, so that resume() goes on from the first range nobody took
+    void pause();
+    void resume();
+
+    // Returns signed block, once current job succeeds, only once per job
+    std::optional<block> poll();
+
+    // Job is started and neither succeeded, nor ran out of time/signatures,
+    // nor is paused
+    bool is_running() const;
+
+    unsigned num_threads() const { return num_threads_; }
+
+    // Non-blocking eventfd, that becomes readable when a job finishes by
+    // itself (succeeds, or runs out of time/signatures). It's not reset by
+    // poll(), reading it is up to whoever waits on it.
+    int completion_fd() const { return completion_fd_; }
+
+    mining_stats stats() const;
+
+private:
+    struct job {
+        block candidate;
+        hash256_t midstate;
+
+        std::chrono::steady_clock::time_point started;
+        std::chrono::steady_clock::time_point deadline;
+
+        std::atomic<uint64_t> next_range = 0;
+        std::atomic<bool> should_stop = false;
+
+        bool is_paused = false;
+        std::chrono::steady_clock::time_point paused;
+
+        // Written only by the worker that set is_signed:
+        std::atomic<bool> is_signed = false;
+        uint32_t signature = 0, extra_signature = 0;
+
+        // Each worker adds to its own entry once it is done with the job
+        std::vector<uint64_t> hashes;
+
+        int completion_fd;
+    };
+
+    // Updated by workers as they go, and read at any time through stats()
+    struct alignas(64) thread_counters {
+        std::atomic<uint64_t> hashes = 0;
+        std::atomic<uint64_t> solutions = 0;
+        std::atomic<uint64_t> wasted_hashes = 0;
+        std::atomic<int64_t> busy_nanoseconds = 0;
+
+        std::array<std::atomic<uint64_t>, mining_stats::NUM_HISTOGRAM_BUCKETS> time_to_solution {};
+    };
+
+    unsigned num_threads_;
+    int completion_fd_;
+
+    std::unique_ptr<job> job_;
+
+    std::mutex mutex_;
+    std::condition_variable started_, finished_;
+
+    uint64_t generation_ = 0; // Incremented every time job starts
+    unsigned busy_workers_ = 0;
+    bool should_exit_ = false;
+
+    std::vector<std::jthread> workers_;
+
+    std::unique_ptr<thread_counters[]> counters_;
+
+    std::atomic<uint64_t> jobs_solved_ = 0, jobs_cancelled_ = 0;
+
+    static void work(job &current, unsigned worker, thread_counters &counters);
+    void serve(unsigned worker);
+
+    // Waits until every worker is done with current job
+    void join();
+
+    // Wakes workers up to work on current job
+    void wake();
+};
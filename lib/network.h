@@ -2,10 +2,24 @@
 
 #include "broadcast.h"
 
+#include <cstddef>
+
 template <typename type>
-concept distributed_network = requires(type net, buffer message, address target, address* out_sender_addr, buffer out_message) {
+concept distributed_network = requires(type net, buffer message, address target, address* out_sender_addr, buffer out_message,
+                                       const buffer* messages, buffer* out_messages, size_t count) {
     { net.send(message, target) } -> std::convertible_to<bool>;
     { net.broadcast(message) } -> std::convertible_to<bool>;
     { net.receive(out_message, out_sender_addr) } -> std::convertible_to<bool>;
+
+    { net.send_batch(messages, count, target) } -> std::convertible_to<size_t>;
+    { net.broadcast_batch(messages, count) } -> std::convertible_to<size_t>;
+    { net.receive_batch(out_messages, out_sender_addr, count) } -> std::convertible_to<size_t>;
+
+    { net.receive_fd() } -> std::convertible_to<int>;
+
+    { net.address_change_fd() } -> std::convertible_to<int>;
+    { net.refresh_local_addresses() };
 };
 
+static_assert(distributed_network<network>);
+static_assert(distributed_network<uring_network>);
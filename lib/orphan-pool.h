@@ -0,0 +1,106 @@
+#pragma once
+
+#include "block.h"
+#include "hash-map.h"
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+
+// Blocks whose parents aren't linked yet, grouped by the parent they wait
+// for, so that once it's linked, all of its children are found at once.
+// Pool is bounded, both in size and in how long orphans are kept: when
+// it's full, or orphans get too old, they're dropped oldest first.
+class orphan_pool {
+public:
+    using clock = std::chrono::steady_clock;
+
+    orphan_pool(size_t max_size, clock::duration max_age):
+        max_size_(max_size),
+        max_age_(max_age) {
+    }
+
+    bool contains(const hash256_t &hash) const {
+        return parents_.contains(hash);
+    }
+
+    size_t size() const { return parents_.size(); }
+
+    void add(const hashed_block &orphan, clock::time_point now = clock::now()) {
+        if (!parents_.insert(orphan.hash(), orphan.data().previous_hash))
+            return; // It's already waiting
+
+        by_parent_.emplace(orphan.data().previous_hash, orphan);
+        arrivals_.push_back({ orphan.hash(), now });
+
+        evict(now);
+    }
+
+    // Removes blocks waiting for `parent`, and returns them
+    std::vector<hashed_block> take_children(const hash256_t &parent) {
+        std::vector<hashed_block> children;
+
+        auto [begin, end] = by_parent_.equal_range(parent);
+        for (auto it = begin; it != end; ++ it) {
+            parents_.erase(it->second.hash());
+            children.push_back(it->second);
+        }
+
+        by_parent_.erase(begin, end);
+        return children;
+    }
+
+    // Drops orphans that are too old, or don't fit. Returns how many
+    size_t evict(clock::time_point now = clock::now()) {
+        size_t evicted = 0;
+
+        while (!arrivals_.empty()) {
+            const arrival &oldest = arrivals_.front();
+
+            const hash256_t *parent = parents_.find(oldest.hash);
+            bool is_taken = !parent; // Its parent got linked
+            if (!is_taken && parents_.size() <= max_size_ && now - oldest.time <= max_age_)
+                break;
+
+            if (!is_taken) {
+                remove(oldest.hash, *parent);
+                ++ evicted;
+            }
+
+            arrivals_.pop_front();
+        }
+
+        return evicted;
+    }
+
+private:
+    struct arrival {
+        hash256_t hash;
+        clock::time_point time;
+    };
+
+    size_t max_size_;
+    clock::duration max_age_;
+
+    std::unordered_multimap<hash256_t, hashed_block> by_parent_;
+    hash256_map<hash256_t> parents_; // Parent of every orphan in the pool, by its hash
+
+    // Orphans in the order they came in, entries of taken ones are
+    // skipped once they get to the front
+    std::deque<arrival> arrivals_;
+
+    void remove(const hash256_t &hash, const hash256_t &parent) {
+        auto [begin, end] = by_parent_.equal_range(parent);
+        for (auto it = begin; it != end; ++ it) {
+            if (it->second.hash() == hash) {
+                by_parent_.erase(it);
+                break;
+            }
+        }
+
+        parents_.erase(hash); // Last, `parent` can point into it
+    }
+};
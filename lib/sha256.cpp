@@ -5,6 +5,19 @@
 #include <byteswap.h>
 #include <assert.h>
 
+#include <bit>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 static const size_t BITS_IN_BYTE = 8;
 
 static inline uint32_t rotr(const uint32_t value, const unsigned short count) {
@@ -55,25 +68,7 @@ static inline uint32_t upsigma1(const uint32_t value) {
     return rotr(value, 6) ^ rotr(value, 11) ^ rotr(value, 25);
 }
 
-// Constants mandated by the SHA-256 specification
-static const uint32_t K[64] = {
-    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
-    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
-    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
-    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
-    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
-    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
-    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
-    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
-    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-};
+static constexpr const uint32_t (&K)[64] = SHA_256_ROUND_CONSTANTS;
 
 // Message data processing stage
 enum separating_stage {
@@ -125,9 +120,10 @@ inline static bool message_write_completed_words(message_data* const data,
 
     // Write full 32 bit words to the output array, if there's too
     // many of them, we're taking first 512 bits (16 of 32 bit words)
-    for (size_t i = 0LU; i < completed_words_in_this_message; ++ i)
-        message[(*written_words) ++] =
-            ((const uint32_t*) (data->data + data->bytes_read))[i];
+    memcpy(message + *written_words, data->data + data->bytes_read,
+           completed_words_in_this_message * sizeof(uint32_t));
+
+    *written_words += completed_words_in_this_message;
 
     data->bytes_read += completed_words_in_this_message * sizeof(uint32_t);
 
@@ -202,7 +198,7 @@ inline static void message_write_size(message_data* const data,
     if (is_little_endian)
         message_size = __bswap_64(message_size);
 
-    *(uint64_t*) &message[*written_words] = message_size;
+    memcpy(&message[*written_words], &message_size, sizeof(message_size));
     data->stage = FINISHED;
 }
 
@@ -266,24 +262,6 @@ inline static void generate_message_schedule(uint32_t words[64]) {
                  + sigma0(words[i - 15]) + words[i - 16];
 }
 
-static const __uint32_t H[8] = {
-    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
-    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
-};
-
-inline static int modulo(int a, int b) {
-    int mod = a % b;
-
-    if (mod < 0)
-        mod = (b < 0) ? mod - b : mod + b;
-
-    return mod;
-}
-
-inline static uint32_t* modulo_get(uint32_t* array, int index, int size) {
-    return &array[modulo(index, size)];
-};
-
 // Registers for compression stage of computing SHA-256.
 // They named according to the standard. Order and according number matters.
 enum registers {
@@ -295,36 +273,130 @@ enum registers {
 inline static void compress(uint32_t schedule[64],
                             uint32_t registers[NUM_REGISTERS]) {
 
-    uint32_t starting_values[8];
-    memcpy(starting_values, registers, sizeof(starting_values));
+    uint32_t a = registers[REG_A], b = registers[REG_B],
+             c = registers[REG_C], d = registers[REG_D],
+             e = registers[REG_E], f = registers[REG_F],
+             g = registers[REG_G], h = registers[REG_H];
+
+    // Instead of shifting values between registers after every round,
+    // each of eight consecutive rounds gets them renamed by one position:
+    // H will become A after the round, and D will become E.
+    #define ROUND(a, b, c, d, e, f, g, h, i)                                       \
+        {                                                                          \
+            uint32_t t1 = upsigma1(e) + choice(e, f, g) + h + K[i] + schedule[i],  \
+                     t2 = upsigma0(a) +    maj(a, b, c);                           \
+                                                                                   \
+            h = t1 + t2;                                                           \
+            d += t1;                                                               \
+        }
 
-    for (int i = 0; i < 64; ++ i) {
-        #define GET_REG(reg) \
-            modulo_get(registers, REG_##reg - i, NUM_REGISTERS)
+    #pragma GCC unroll 8
+    for (int i = 0; i < 64; i += 8) {
+        ROUND(a, b, c, d, e, f, g, h, i + 0);
+        ROUND(h, a, b, c, d, e, f, g, i + 1);
+        ROUND(g, h, a, b, c, d, e, f, i + 2);
+        ROUND(f, g, h, a, b, c, d, e, i + 3);
+        ROUND(e, f, g, h, a, b, c, d, i + 4);
+        ROUND(d, e, f, g, h, a, b, c, i + 5);
+        ROUND(c, d, e, f, g, h, a, b, i + 6);
+        ROUND(b, c, d, e, f, g, h, a, i + 7);
+    }
+
+    #undef ROUND
+
+    registers[REG_A] += a; registers[REG_B] += b;
+    registers[REG_C] += c; registers[REG_D] += d;
+    registers[REG_E] += e; registers[REG_F] += f;
+    registers[REG_G] += g; registers[REG_H] += h;
+}
+
+// ================ COMPRESSION BACKENDS ================
+
+// Compresses one block, whose first 16 words are filled with message
+// data, rest of `message` can be used by the backend as scratch space
+typedef void (*block_compressor)(uint32_t message[64],
+                                 uint32_t registers[NUM_REGISTERS]);
+
+static void compress_scalar(uint32_t message[64],
+                            uint32_t registers[NUM_REGISTERS]) {
+
+    // Generate another 64 - 16 message entries:
+    generate_message_schedule(message);
+
+    // Compression stage, use previous values in registers for it:
+    compress(message, registers);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Intel SHA extensions keep state in two registers, packed like so:
+// ABEF and CDGH, and compute two rounds per sha256rnds2 instruction.
+__attribute__((target("sha,sse4.1")))
+static void compress_sha_ni(uint32_t message[64],
+                            uint32_t registers[NUM_REGISTERS]) {
 
-        uint32_t a = *GET_REG(A), b = *GET_REG(B), c = *GET_REG(C),
-                 e = *GET_REG(E), f = *GET_REG(F), g = *GET_REG(G),
-                 h = *GET_REG(H);
+    __m128i abef, cdgh;
+    {
+        __m128i dcba = _mm_loadu_si128((const __m128i*) &registers[REG_A]);
+        __m128i hgfe = _mm_loadu_si128((const __m128i*) &registers[REG_E]);
+
+        __m128i cdab = _mm_shuffle_epi32(dcba, 0xB1);
+        __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1B);
+
+        abef = _mm_alignr_epi8(cdab, efgh, 8);
+        cdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+    }
 
-        uint32_t t1 = upsigma1(e) + choice(e, f, g) + h + K[i] + schedule[i],
-                 t2 = upsigma0(a) +    maj(a, b, c);
+    const __m128i abef_saved = abef, cdgh_saved = cdgh;
 
-        // H will become A after the cycle:
-        *GET_REG(H) = t1 + t2;
+    // Message words are already in host order, no need to shuffle bytes:
+    __m128i words[4];
+    for (int i = 0; i < 4; ++ i)
+        words[i] = _mm_loadu_si128((const __m128i*) &message[4 * i]);
 
-        // D will become E after the cycle:
-        *GET_REG(D) += t1;
+    // Every iteration does four rounds, while extending schedule
+    // for the upcoming ones in a sliding window of four registers
+    #pragma GCC unroll 16
+    for (int i = 0; i < 16; ++ i) {
+        __m128i &current = words[i % 4];
 
-        #undef GET_REG
+        __m128i rounds = _mm_add_epi32(current, _mm_loadu_si128((const __m128i*) &K[4 * i]));
+        cdgh = _mm_sha256rnds2_epu32(cdgh, abef, rounds);
+
+        if (i >= 3 && i < 15) {
+            __m128i &next = words[(i + 1) % 4];
+
+            next = _mm_add_epi32(next, _mm_alignr_epi8(current, words[(i + 3) % 4], 4));
+            next = _mm_sha256msg2_epu32(next, current);
+        }
+
+        rounds = _mm_shuffle_epi32(rounds, 0x0E);
+        abef = _mm_sha256rnds2_epu32(abef, cdgh, rounds);
+
+        if (i >= 1 && i < 13) {
+            __m128i &previous = words[(i + 3) % 4];
+            previous = _mm_sha256msg1_epu32(previous, current);
+        }
     }
 
-    for (int i = 0; i < 8; ++ i)
-        registers[i] += starting_values[i];
+    abef = _mm_add_epi32(abef, abef_saved);
+    cdgh = _mm_add_epi32(cdgh, cdgh_saved);
+
+    {
+        __m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+        __m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+
+        _mm_storeu_si128((__m128i*) &registers[REG_A], _mm_blend_epi16(feba, dchg, 0xF0));
+        _mm_storeu_si128((__m128i*) &registers[REG_E], _mm_alignr_epi8(dchg, feba, 8));
+    }
 }
 
-void hash_with_sha_256(const void* const data_ptr,
-                       const size_t size,
-                       uint32_t output_hash[8]) {
+#endif
+
+static void hash_with_compressor(block_compressor compressor,
+                                 const void* const data_ptr,
+                                 const size_t size,
+                                 uint32_t output_hash[8]) {
 
     uint32_t message[64];
 
@@ -332,15 +404,489 @@ void hash_with_sha_256(const void* const data_ptr,
         construct_message_data(data_ptr, size);
 
     // Fill registers with H0 values
-    memcpy(output_hash, H, 8 * sizeof(uint32_t));
+    memcpy(output_hash, SHA_256_INITIAL_HASH, 8 * sizeof(uint32_t));
+
+    while(get_next_message_block(&data, message))
+        compressor(message, output_hash);
+}
+
+// Hashes messages of many different sizes (which covers all padding cases)
+// with both backends and compares results, used to check hardware backends
+static bool self_test_compressor(block_compressor compressor) {
+    unsigned char sample[3 * WORDS_IN_MESSAGE * sizeof(uint32_t)];
+    for (size_t i = 0; i < sizeof(sample); ++ i)
+        sample[i] = (unsigned char) (i * 167 + 13);
+
+    for (size_t size = 0; size <= sizeof(sample); ++ size) {
+        uint32_t expected[8], actual[8];
+
+        hash_with_compressor(compress_scalar, sample, size, expected);
+        hash_with_compressor(compressor,      sample, size, actual);
+
+        if (memcmp(expected, actual, sizeof(expected)) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+std::vector<sha_256_compressor> get_sha_256_compressors() {
+    std::vector<sha_256_compressor> compressors = { { "scalar", compress_scalar } };
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1"))
+        compressors.push_back({ "sha-ni", compress_sha_ni });
+#endif
+
+    return compressors;
+}
+
+static block_compressor select_compressor(void) {
+    sha_256_compressor fastest = get_sha_256_compressors().back();
+    if (fastest.compress == compress_scalar || self_test_compressor(fastest.compress))
+        return fastest.compress;
+
+    fprintf(stderr, "%s self-test failed, falling back to scalar SHA-256\n", fastest.name);
+    return compress_scalar;
+}
+
+// Backend is picked once, on first use, so that it's there even for
+// static initializers of other translation units that hash something
+static block_compressor get_compressor(void) {
+    static const block_compressor selected = select_compressor();
+    return selected;
+}
+
+void compress_with_sha_256(uint32_t message[64],
+                           uint32_t registers[HASH_SIZE]) {
+
+    get_compressor()(message, registers);
+}
+
+void hash_with_sha_256(const void* const data_ptr,
+                       const size_t size,
+                       uint32_t output_hash[8]) {
+
+    hash_with_compressor(get_compressor(), data_ptr, size, output_hash);
+}
+
+// ================ STREAMING ================
+
+void init_sha_256(sha_256_context* const context) {
+    memcpy(context->registers, SHA_256_INITIAL_HASH, sizeof(context->registers));
+
+    context->pending_size = 0;
+    context->total_size = 0;
+}
+
+void update_sha_256(sha_256_context* const context,
+                    const void* const data_ptr,
+                    const size_t size) {
+
+    const unsigned char* data = (const unsigned char*) data_ptr;
+    const unsigned char* const end = data + size;
+
+    uint32_t message[64];
+    context->total_size += size;
+
+    // Complete message block left from the previous chunk:
+    if (context->pending_size != 0) {
+        const size_t missing = SHA_256_BLOCK_SIZE - context->pending_size;
+        const size_t taken = MIN(missing, size);
+
+        memcpy(context->pending + context->pending_size, data, taken);
+        context->pending_size += taken;
+        data += taken;
+
+        if (context->pending_size < SHA_256_BLOCK_SIZE)
+            return; // Still not enough data for a whole block
+
+        load_sha_256_block(context->pending, message);
+        compress_with_sha_256(message, context->registers);
+
+        context->pending_size = 0;
+    }
+
+    // Whole blocks are compressed right from the chunk, without copying:
+    for (; end - data >= (ptrdiff_t) SHA_256_BLOCK_SIZE; data += SHA_256_BLOCK_SIZE) {
+        load_sha_256_block(data, message);
+        compress_with_sha_256(message, context->registers);
+    }
+
+    memcpy(context->pending, data, end - data);
+    context->pending_size = end - data;
+}
+
+void final_sha_256(sha_256_context* const context,
+                   uint32_t output_hash[HASH_SIZE]) {
+
+    const uint64_t size_in_bits = context->total_size * BITS_IN_BYTE;
+
+    unsigned char padding[2 * SHA_256_BLOCK_SIZE] = { 0x80 };
+
+    // Pad up to the last 8 bytes of the block, which are taken by the size:
+    size_t padding_size = SHA_256_BLOCK_SIZE - context->pending_size;
+    if (padding_size < 1 + sizeof(uint64_t))
+        padding_size += SHA_256_BLOCK_SIZE;
+
+    for (size_t i = 0; i < sizeof(uint64_t); ++ i)
+        padding[padding_size - 1 - i] = (unsigned char) (size_in_bits >> (BITS_IN_BYTE * i));
+
+    update_sha_256(context, padding, padding_size);
+    assert(context->pending_size == 0);
+
+    memcpy(output_hash, context->registers, sizeof(context->registers));
+}
 
-    while(get_next_message_block(&data, message)) {
-        // Generate another 64 - 16 message entries:
-        generate_message_schedule(message);
+bool hash_file_with_sha_256(const char* const path,
+                            uint32_t output_hash[HASH_SIZE]) {
 
-        // Compression stage, use previous values in registers for it:
-        compress(message, output_hash);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        return false;
     }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0) {
+        perror("fstat");
+        close(fd);
+
+        return false;
+    }
+
+    sha_256_context context;
+    init_sha_256(&context);
+
+    const size_t size = file_stat.st_size;
+    if (size != 0) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            perror("mmap");
+            close(fd);
+
+            return false;
+        }
+
+        // File is read front to back exactly once:
+        madvise(mapped, size, MADV_SEQUENTIAL);
+
+        update_sha_256(&context, mapped, size);
+        munmap(mapped, size);
+    }
+
+    close(fd);
+
+    final_sha_256(&context, output_hash);
+    return true;
+}
+
+// ================ MULTI-BUFFER SIMD ================
+
+// Every lane of these vectors holds the same word of a different message,
+// so one vector instruction advances all of them at once. GCC vector
+// extensions compile down to SSE/AVX2/AVX-512 (or NEON) depending on
+// the target of the function they end up inlined into.
+typedef uint32_t lanes4_t  __attribute__((vector_size( 4 * sizeof(uint32_t))));
+typedef uint32_t lanes8_t  __attribute__((vector_size( 8 * sizeof(uint32_t))));
+typedef uint32_t lanes16_t __attribute__((vector_size(16 * sizeof(uint32_t))));
+
+// Vectors are never passed by value here, because their ABI
+// depends on the target, that's why these are macros:
+#define ROTR_LANES(value, count) \
+    ((value) >> (count) | (value) << (sizeof(uint32_t) * BITS_IN_BYTE - (count)))
+
+#define SIGMA0_LANES(value)   (ROTR_LANES(value,  7) ^ ROTR_LANES(value, 18) ^ ((value) >>  3))
+#define SIGMA1_LANES(value)   (ROTR_LANES(value, 17) ^ ROTR_LANES(value, 19) ^ ((value) >> 10))
+#define UPSIGMA0_LANES(value) (ROTR_LANES(value,  2) ^ ROTR_LANES(value, 13) ^ ROTR_LANES(value, 22))
+#define UPSIGMA1_LANES(value) (ROTR_LANES(value,  6) ^ ROTR_LANES(value, 11) ^ ROTR_LANES(value, 25))
+
+template <typename lanes_t>
+__attribute__((always_inline))
+inline static void compress_lanes(lanes_t schedule[64],
+                                  lanes_t registers[NUM_REGISTERS]) {
+
+    for (int i = 16; i < 64; ++ i)
+        schedule[i] = SIGMA1_LANES(schedule[i -  2]) + schedule[i -  7]
+                    + SIGMA0_LANES(schedule[i - 15]) + schedule[i - 16];
+
+    lanes_t a = registers[REG_A], b = registers[REG_B],
+            c = registers[REG_C], d = registers[REG_D],
+            e = registers[REG_E], f = registers[REG_F],
+            g = registers[REG_G], h = registers[REG_H];
+
+    for (int i = 0; i < 64; ++ i) {
+        lanes_t t1 = UPSIGMA1_LANES(e) + ((e & f) | (g & ~ e)) + h + K[i] + schedule[i],
+                t2 = UPSIGMA0_LANES(a) + ((a & (b | c)) | (b & c));
+
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    registers[REG_A] += a; registers[REG_B] += b;
+    registers[REG_C] += c; registers[REG_D] += d;
+    registers[REG_E] += e; registers[REG_F] += f;
+    registers[REG_G] += g; registers[REG_H] += h;
+}
+
+// Hashes exactly `lanes` messages of equal size, one per vector lane
+template <typename lanes_t, size_t... lane_indices>
+__attribute__((always_inline))
+inline static void hash_lanes(std::index_sequence<lane_indices...>,
+                              const void* const data_ptrs[],
+                              const size_t size,
+                              uint32_t output_hashes[][HASH_SIZE]) {
+
+    constexpr size_t lanes = sizeof...(lane_indices);
+
+    lanes_t registers[NUM_REGISTERS], schedule[64];
+    for (int i = 0; i < NUM_REGISTERS; ++ i)
+        for (size_t lane = 0; lane < lanes; ++ lane)
+            registers[i][lane] = SHA_256_INITIAL_HASH[i];
+
+    message_data data[lanes] = {
+        construct_message_data(data_ptrs[lane_indices], size)...
+    };
+
+    uint32_t message[WORDS_IN_MESSAGE];
+
+    // All messages have the same size, so they run out of blocks together:
+    while (get_next_message_block(&data[0], message)) {
+        for (size_t lane = 0; lane < lanes; ++ lane) {
+            if (lane != 0)
+                get_next_message_block(&data[lane], message);
+
+            for (size_t word = 0; word < WORDS_IN_MESSAGE; ++ word)
+                schedule[word][lane] = message[word];
+        }
+
+        compress_lanes(schedule, registers);
+    }
+
+    for (int i = 0; i < NUM_REGISTERS; ++ i)
+        for (size_t lane = 0; lane < lanes; ++ lane)
+            output_hashes[lane][i] = registers[i][lane];
+}
+
+inline static uint32_t load_big_endian_word(const unsigned char* bytes) {
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+
+    if constexpr (std::endian::native == std::endian::little)
+        word = __builtin_bswap32(word);
+
+    return word;
+}
+
+// Same as hash_lanes, for messages of compile-time known size. Padding is
+// the same in every lane, so its words are just broadcast from the layout,
+// and only words that hold message data are gathered from the lanes.
+template <typename lanes_t, size_t size, size_t... lane_indices>
+__attribute__((always_inline))
+inline static void hash_fixed_lanes(std::index_sequence<lane_indices...>,
+                                    const void* const data_ptrs[],
+                                    uint32_t output_hashes[][HASH_SIZE]) {
+
+    using layout = sha_256_fixed_layout<size>;
+    constexpr size_t tail_offset = layout::full_blocks * SHA_256_BLOCK_SIZE;
+
+    constexpr size_t lanes = sizeof...(lane_indices);
+    const unsigned char* const data[lanes] = { (const unsigned char*) data_ptrs[lane_indices]... };
+
+    lanes_t registers[NUM_REGISTERS], schedule[64];
+    for (int i = 0; i < NUM_REGISTERS; ++ i)
+        registers[i] = lanes_t {} + SHA_256_INITIAL_HASH[i];
+
+    #pragma GCC unroll 4
+    for (size_t block = 0; block < layout::total_blocks; ++ block) {
+        #pragma GCC unroll 16
+        for (size_t word = 0; word < WORDS_IN_MESSAGE; ++ word) {
+            const size_t offset = block * SHA_256_BLOCK_SIZE + word * sizeof(uint32_t);
+
+            if (offset + sizeof(uint32_t) <= size)
+                schedule[word] = lanes_t { load_big_endian_word(data[lane_indices] + offset)... };
+            else if (offset >= size)
+                schedule[word] = lanes_t {} + load_big_endian_word(layout::padding.data() + offset - tail_offset);
+            else {
+                // Word where message data ends and padding starts
+                for (size_t lane = 0; lane < lanes; ++ lane) {
+                    unsigned char bytes[sizeof(uint32_t)];
+                    memcpy(bytes, layout::padding.data() + offset - tail_offset, sizeof(bytes));
+                    memcpy(bytes, data[lane] + offset, size - offset);
+
+                    schedule[word][lane] = load_big_endian_word(bytes);
+                }
+            }
+        }
+
+        compress_lanes(schedule, registers);
+    }
+
+    for (int i = 0; i < NUM_REGISTERS; ++ i)
+        for (size_t lane = 0; lane < lanes; ++ lane)
+            output_hashes[lane][i] = registers[i][lane];
+}
+
+// Block headers go through the fixed layout, everything else gets
+// padded block by block, in each of the lanes
+template <typename lanes_t, size_t lanes>
+__attribute__((always_inline))
+inline static void hash_batch_lanes(const void* const data_ptrs[],
+                                    const size_t size,
+                                    uint32_t output_hashes[][HASH_SIZE]) {
+
+    if (size == SHA_256_FIXED_BATCH_SIZE)
+        hash_fixed_lanes<lanes_t, SHA_256_FIXED_BATCH_SIZE>(std::make_index_sequence<lanes>(),
+                                                            data_ptrs, output_hashes);
+    else
+        hash_lanes<lanes_t>(std::make_index_sequence<lanes>(), data_ptrs, size, output_hashes);
+}
+
+#undef ROTR_LANES
+#undef SIGMA0_LANES
+#undef SIGMA1_LANES
+#undef UPSIGMA0_LANES
+#undef UPSIGMA1_LANES
+
+static void hash_batch_scalar(const void* const data_ptrs[],
+                              const size_t size,
+                              uint32_t output_hashes[][HASH_SIZE]) {
+
+    if (size == SHA_256_FIXED_BATCH_SIZE)
+        hash_with_sha_256<SHA_256_FIXED_BATCH_SIZE>(data_ptrs[0], output_hashes[0]);
+    else
+        hash_with_sha_256(data_ptrs[0], size, output_hashes[0]);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse4.1")))
+static void hash_batch_sse4(const void* const data_ptrs[],
+                            const size_t size,
+                            uint32_t output_hashes[][HASH_SIZE]) {
+
+    hash_batch_lanes<lanes4_t, 4>(data_ptrs, size, output_hashes);
+}
+
+__attribute__((target("avx2")))
+static void hash_batch_avx2(const void* const data_ptrs[],
+                            const size_t size,
+                            uint32_t output_hashes[][HASH_SIZE]) {
+
+    hash_batch_lanes<lanes8_t, 8>(data_ptrs, size, output_hashes);
+}
+
+__attribute__((target("avx512f")))
+static void hash_batch_avx512(const void* const data_ptrs[],
+                              const size_t size,
+                              uint32_t output_hashes[][HASH_SIZE]) {
+
+    hash_batch_lanes<lanes16_t, 16>(data_ptrs, size, output_hashes);
+}
+
+#elif defined(__ARM_NEON)
+
+static void hash_batch_neon(const void* const data_ptrs[],
+                            const size_t size,
+                            uint32_t output_hashes[][HASH_SIZE]) {
+
+    hash_batch_lanes<lanes4_t, 4>(data_ptrs, size, output_hashes);
+}
+
+#endif
+
+std::vector<sha_256_batch_kernel> get_sha_256_batch_kernels() {
+    std::vector<sha_256_batch_kernel> kernels = { { "scalar", 1, hash_batch_scalar } };
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse4.1"))  kernels.push_back({ "sse4.1",   4, hash_batch_sse4   });
+    if (__builtin_cpu_supports("avx2"))    kernels.push_back({ "avx2",     8, hash_batch_avx2   });
+    if (__builtin_cpu_supports("avx512f")) kernels.push_back({ "avx512f", 16, hash_batch_avx512 });
+#elif defined(__ARM_NEON)
+    kernels.push_back({ "neon", 4, hash_batch_neon });
+#endif
+
+    return kernels;
+}
+
+// Same check as for compressors: every lane gets its own message, of
+// every size up to three message blocks, compared against scalar hashing
+static bool self_test_batch_kernel(const sha_256_batch_kernel& kernel) {
+    unsigned char sample[3 * WORDS_IN_MESSAGE * sizeof(uint32_t) + SHA_256_MAX_LANES];
+    for (size_t i = 0; i < sizeof(sample); ++ i)
+        sample[i] = (unsigned char) (i * 167 + 13);
+
+    const void* lane_ptrs[SHA_256_MAX_LANES];
+    for (size_t lane = 0; lane < kernel.lanes; ++ lane)
+        lane_ptrs[lane] = sample + lane;
+
+    for (size_t size = 0; size <= sizeof(sample) - SHA_256_MAX_LANES; ++ size) {
+        uint32_t actual[SHA_256_MAX_LANES][HASH_SIZE];
+        kernel.hash(lane_ptrs, size, actual);
+
+        for (size_t lane = 0; lane < kernel.lanes; ++ lane) {
+            uint32_t expected[HASH_SIZE];
+            hash_with_compressor(compress_scalar, sample + lane, size, expected);
+
+            if (memcmp(expected, actual[lane], sizeof(expected)) != 0)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+static sha_256_batch_kernel select_batch_kernel(void) {
+    std::vector<sha_256_batch_kernel> kernels = get_sha_256_batch_kernels();
+
+    sha_256_batch_kernel widest = kernels.back();
+    if (widest.hash == hash_batch_scalar || self_test_batch_kernel(widest))
+        return widest;
+
+    fprintf(stderr, "%s self-test failed, falling back to scalar batch SHA-256\n", widest.name);
+    return kernels.front();
+}
+
+// Widest kernel is picked once, on first use, so that it's there even
+// for static initializers of other translation units that hash something
+static const sha_256_batch_kernel& get_batch_kernel(void) {
+    static const sha_256_batch_kernel selected = select_batch_kernel();
+    return selected;
+}
+
+size_t sha_256_batch_lanes() {
+    return get_batch_kernel().lanes;
+}
+
+void hash_with_sha_256_batch(const void* const data_ptrs[],
+                             const size_t size,
+                             const size_t count,
+                             uint32_t output_hashes[][HASH_SIZE]) {
+
+    const sha_256_batch_kernel& kernel = get_batch_kernel();
+    const size_t lanes = kernel.lanes;
+
+    size_t hashed = 0;
+    for (; hashed + lanes <= count; hashed += lanes)
+        kernel.hash(data_ptrs + hashed, size, output_hashes + hashed);
+
+    if (hashed == count)
+        return;
+
+    // Fill lanes left after the last full pass with copies of the last
+    // message, their results go to a scratch buffer and get dropped:
+    const void* tail_ptrs[SHA_256_MAX_LANES];
+    uint32_t tail_hashes[SHA_256_MAX_LANES][HASH_SIZE];
+
+    for (size_t lane = 0; lane < lanes; ++ lane)
+        tail_ptrs[lane] = data_ptrs[MIN(hashed + lane, count - 1)];
+
+    kernel.hash(tail_ptrs, size, tail_hashes);
+    memcpy(output_hashes + hashed, tail_hashes, (count - hashed) * sizeof(*tail_hashes));
 }
 
 static void print_bitwise_representation(unsigned char value) {
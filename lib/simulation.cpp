@@ -1,5 +1,6 @@
 #include "simulation.h"
 
+#include <algorithm>
 #include <arpa/inet.h>
 #include <climits>
 #include <cstdint>
@@ -9,6 +10,8 @@
 #include <mutex>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <vector>
@@ -24,50 +27,109 @@ address to_address(uint16_t id) {
 }
 
 
-bool simulation::send(buffer message, address target_addr) {
+simulation::simulation(std::map<address, mailbox> &senders,
+                       uint32_t address,
+                       std::mutex *mutex):
+    address_(address),
+    event_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    senders_(&senders),
+    mutex_(mutex) {
+
+    if (event_fd_ < 0)
+        perror("eventfd");
+
     std::lock_guard<std::mutex> lock(*mutex_);
+    (*senders_)[to_address(address_)].event_fd = event_fd_;
+}
+
+simulation_builder::~simulation_builder() {
+    for (auto &[receiver_address, receiver]: senders_)
+        if (receiver.event_fd >= 0)
+            close(receiver.event_fd);
+}
+
+namespace {
+
+void deliver(mailbox &receiver, packet sent_packet) {
+    if (receiver.packets.empty() && receiver.event_fd >= 0)
+        eventfd_write(receiver.event_fd, 1);
 
+    receiver.packets.push_back(std::move(sent_packet));
+}
+
+packet make_packet(uint32_t sender, buffer message) {
     std::vector<char> data{
         static_cast<char*>(message.data),
         static_cast<char*>(message.data) + message.size
     };
 
-    packet sent_packet {to_address(address_), std::move(data)};
-    (*senders_)[target_addr].push_back(std::move(sent_packet));
+    return {to_address(sender), std::move(data)};
+}
+
+}
 
-    return true;
+bool simulation::send(buffer message, address target_addr) {
+    return send_batch(&message, 1, target_addr) == 1;
 }
 
 bool simulation::broadcast(buffer message) {
+    return broadcast_batch(&message, 1) == 1;
+}
+
+bool simulation::receive(buffer out_message, address *out_sender_addr) {
+    return receive_batch(&out_message, out_sender_addr, 1) == 1;
+}
+
+size_t simulation::send_batch(const buffer *messages, size_t count, address target_addr) {
     std::lock_guard<std::mutex> lock(*mutex_);
 
-    std::vector<char> data{
-        static_cast<char*>(message.data),
-        static_cast<char*>(message.data) + message.size
-    };
+    mailbox &receiver = (*senders_)[target_addr];
+    for (size_t i = 0; i < count; ++ i)
+        deliver(receiver, make_packet(address_, messages[i]));
+
+    return count;
+}
+
+size_t simulation::broadcast_batch(const buffer *messages, size_t count) {
+    std::lock_guard<std::mutex> lock(*mutex_);
+
+    for (size_t i = 0; i < count; ++ i) {
+        packet sent_packet = make_packet(address_, messages[i]);
 
-    packet sent_packet {to_address(address_), std::move(data)};
-    for (auto &[sender_address, packets]: *senders_)
-        packets.push_back(std::move(sent_packet));
+        // Every other node gets its own copy, network drops own broadcasts too
+        for (auto &[receiver_address, receiver]: *senders_)
+            if (receiver_address != to_address(address_))
+                deliver(receiver, sent_packet);
+    }
 
-    return true;
+    return count;
 }
 
-bool simulation::receive(buffer out_message, address *out_sender_addr) {
+size_t simulation::receive_batch(buffer *out_messages, address *out_sender_addrs, size_t count) {
     std::lock_guard<std::mutex> lock(*mutex_);
 
-    auto &packets = (*senders_)[to_address(address_)];
-    if (packets.empty())
-        return false;
+    mailbox &own = (*senders_)[to_address(address_)];
+    auto &packets = own.packets;
 
-    packet received = std::move(packets.back());
-    packets.pop_back();
+    size_t received = 0;
+    while (received < count && !packets.empty()) {
+        packet &next = packets.front();
 
-    // TODO: receive part's of the packet...
+        // Datagrams that don't fit get truncated
+        size_t size = std::min(next.data.size(), out_messages[received].size);
+        memcpy(out_messages[received].data, next.data.data(), size);
 
-    memcpy(out_message.data, &*received.data.begin(), received.data.size());
-    *out_sender_addr = received.sender;
+        out_messages[received].size = size;
+        out_sender_addrs[received] = next.sender;
 
-    return true;
-}
+        packets.pop_front();
+        ++ received;
+    }
 
+    if (packets.empty() && own.event_fd >= 0) {
+        eventfd_t pending;
+        eventfd_read(own.event_fd, &pending);
+    }
+
+    return received;
+}
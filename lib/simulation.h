@@ -4,7 +4,9 @@
 #include "broadcast.h"
 
 #include <map>
+#include <deque>
 #include <vector>
+#include <cstddef>
 #include <cstdint>
 #include <mutex>
 
@@ -14,34 +16,50 @@ struct packet {
     std::vector<char> data;
 };
 
+struct mailbox {
+    std::deque<packet> packets;
+    int event_fd = -1; // Readable while there are packets, if node listens
+};
+
 class simulation {
 public:
-    simulation(std::map<address, std::vector<packet>> &senders,
+    // Registers node's mailbox right away, so that it gets every broadcast
+    simulation(std::map<address, mailbox> &senders,
                uint32_t address,
-               std::mutex *mutex):
-        address_(address),
-        senders_(&senders),
-        mutex_(mutex) {
-    }
+               std::mutex *mutex);
 
     bool send(buffer message, address target);
     bool broadcast(buffer message);
     bool receive(buffer out_message, address *out_sender_addr);
 
+    // Batches are queued or taken under a single lock, see network
+    size_t send_batch(const buffer *messages, size_t count, address target);
+    size_t broadcast_batch(const buffer *messages, size_t count);
+    size_t receive_batch(buffer *out_messages, address *out_sender_addrs, size_t count);
+
+    int receive_fd() const { return event_fd_; }
+
+    // Own broadcasts are never delivered back, there's nothing to watch
+    int address_change_fd() const { return -1; }
+    void refresh_local_addresses() {}
+
 private:
     uint32_t address_;
-    std::map<address, std::vector<packet>> *senders_;
+    int event_fd_;
+    std::map<address, mailbox> *senders_;
     std::mutex *mutex_;
 };
 
 class simulation_builder {
 public:
     simulation_builder(): address_(0) {}
+    ~simulation_builder();
+
     simulation produce_node() { return {senders_, address_ ++, &mutex_}; }
 
 private:
     uint32_t address_;
-    std::map<address, std::vector<packet>> senders_;
+    std::map<address, mailbox> senders_;
     std::mutex mutex_;
 };
 
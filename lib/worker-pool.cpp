@@ -0,0 +1,87 @@
+#include "worker-pool.h"
+
+#include <algorithm>
+
+
+worker_pool::worker_pool(unsigned num_threads) {
+    // Calling thread takes part in every loop too, so it's one less:
+    for (unsigned i = 1; i < num_threads; ++ i)
+        workers_.emplace_back([this] { work(); });
+}
+
+worker_pool::~worker_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        should_stop_ = true;
+    }
+
+    started_.notify_all();
+    workers_.clear(); // Joins all of them
+}
+
+void worker_pool::run_chunks(loop &current) {
+    while (true) {
+        size_t begin = current.next_chunk.fetch_add(1, std::memory_order_relaxed) * current.chunk_size;
+        if (begin >= current.count)
+            return;
+
+        (*current.body)(begin, std::min(begin + current.chunk_size, current.count));
+    }
+}
+
+void worker_pool::work() {
+    uint64_t seen_generation = 0;
+
+    while (true) {
+        loop* current;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            started_.wait(lock, [&] { return should_stop_ || generation_ != seen_generation; });
+
+            if (should_stop_)
+                return;
+
+            seen_generation = generation_;
+            current = current_;
+        }
+
+        run_chunks(*current);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            -- busy_workers_;
+        }
+
+        finished_.notify_one();
+    }
+}
+
+void worker_pool::parallel_for(size_t count, size_t chunk_size,
+                               const std::function<void (size_t, size_t)> &body) {
+
+    if (chunk_size == 0)
+        chunk_size = 1;
+
+    loop current { .body = &body, .count = count, .chunk_size = chunk_size };
+
+    // Not worth waking anyone up for a single chunk:
+    if (count <= chunk_size || workers_.empty()) {
+        run_chunks(current);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        current_ = &current;
+        busy_workers_ = workers_.size();
+        ++ generation_;
+    }
+
+    started_.notify_all();
+    run_chunks(current);
+
+    // Workers still hold a reference to the loop, wait for all of them:
+    std::unique_lock<std::mutex> lock(mutex_);
+    finished_.wait(lock, [&] { return busy_workers_ == 0; });
+    current_ = nullptr;
+}
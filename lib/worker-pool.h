@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Fixed set of threads, that sleep until the owner runs a parallel loop.
+// Unlike miner, it's meant for short bursts of work the caller waits for.
+class worker_pool {
+public:
+    explicit worker_pool(unsigned num_threads);
+    ~worker_pool();
+
+    worker_pool(const worker_pool &other) = delete;
+    worker_pool& operator=(const worker_pool &other) = delete;
+
+    // Splits [0, count) into chunks of `chunk_size`, and calls `body(begin, end)`
+    // on each of them, from the workers and the calling thread. Returns once
+    // all chunks are done. Must not be called from multiple threads at once.
+    void parallel_for(size_t count, size_t chunk_size,
+                      const std::function<void (size_t, size_t)> &body);
+
+    // Counting the calling thread
+    unsigned num_threads() const { return workers_.size() + 1; }
+
+private:
+    struct loop {
+        const std::function<void (size_t, size_t)> *body;
+        size_t count, chunk_size;
+
+        std::atomic<size_t> next_chunk = 0;
+    };
+
+    std::mutex mutex_;
+    std::condition_variable started_, finished_;
+
+    loop* current_ = nullptr;
+    uint64_t generation_ = 0; // Incremented every time loop starts
+    unsigned busy_workers_ = 0;
+    bool should_stop_ = false;
+
+    std::vector<std::jthread> workers_;
+
+    static void run_chunks(loop &current);
+    void work();
+};
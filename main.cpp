@@ -1,10 +1,55 @@
 #include "broadcast.h"
 #include "blockchain.h"
+#include "log-multiplexer.h"
+
+#include <stdio.h>
 
 constexpr int PORT = 12345;
 
-int main() {
-    network net(PORT);
-    blockchain chain(0, 0, std::move(net));
-    chain.run();
+// Blocks are kept here between restarts
+constexpr const char* STORAGE_DIRECTORY = "blocks";
+
+// Node logs to one pane, and keeps its mining counters in the next one
+constexpr pane_id NODE_PANE = 0;
+constexpr pane_id MINING_STATS_PANE = 1;
+
+template <typename network_type>
+void run_node(network_type &&net, const std::optional<hash256_t> &checkpoint) {
+    log_multiplexer multiplexer;
+    multiplexer.create_pane(NODE_PANE, "node", pane::LOG);
+    multiplexer.create_pane(MINING_STATS_PANE, "mining", pane::LOG);
+
+    blockchain chain(NODE_PANE, 0, std::move(net), std::thread::hardware_concurrency(), STORAGE_DIRECTORY);
+    chain.show_mining_stats(MINING_STATS_PANE);
+
+    if (checkpoint)
+        chain.assume_valid(*checkpoint);
+
+    // Multiplexer takes over this thread, to read keys, until it's told to quit
+    std::thread node([&chain] { chain.run(); });
+    multiplexer.run();
+
+    chain.stop();
+    node.join();
+}
+
+// Usage: blockchain [checkpoint], where checkpoint is a hash of a block,
+// that, together with all its ancestors, is synced without checking PoW
+int main(int argc, char **argv) {
+    std::optional<hash256_t> checkpoint;
+    if (argc > 1 && !(checkpoint = parse_hash(argv[1]))) {
+        fprintf(stderr, "Checkpoint should be a hash in hex, like the ones in the log: %s\n", argv[1]);
+        return 1;
+    }
+
+    {
+        uring_network net(PORT);
+        if (net.is_ready()) {
+            run_node(std::move(net), checkpoint);
+            return 0;
+        }
+    }
+
+    // Kernel doesn't support io_uring receive, plain sockets are used then
+    run_node(network(PORT), checkpoint);
 }
@@ -0,0 +1,209 @@
+#include "simulation.h"
+#include "blockchain.h"
+#include "block-store.h"
+#include "miner.h"
+
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+// Peer's chain starts with blocks that were never signed, and ends with
+// one that was, right above them:
+//
+//   genesis - f1 - f2 - ... - f1000 - m
+//
+// Peer loads them from its store, which doesn't check anything. Node that
+// syncs from it, and assumes f1000 is valid, has to link all of them, so it
+// can't be checking their PoW. Node that assumes some other block is valid
+// stages them all the same, but can't reach that block, so it has to check
+// them after all, and reject them. So does the node that syncs from a peer,
+// whose store has most of them forged, with votes changed to 'x', but kept
+// under their original hashes: f1000 can't vouch for them.
+
+namespace {
+
+bool check(bool condition, const char *what) {
+    if (!condition)
+        fprintf(stderr, "FAIL: %s\n", what);
+
+    return condition;
+}
+
+constexpr size_t UNSIGNED_COUNT = 1000;
+
+// Every block in a sync batch is forged, but the last one
+constexpr size_t GENUINE_EVERY = MAX_SYNC_BLOCKS;
+
+// Spaced so that difficulty stays the same, and old enough not to be from the future
+block make_unsigned(const block &parent) {
+    block candidate {
+        .version = BLOCK_VERSION,
+        .previous_hash = parent.calculate_hash(),
+        .data = {},
+        .reserved = {},
+        .pow_signature = 0,
+        .pow_extra_signature = 0,
+        .timestamp = parent.timestamp + TARGET_BLOCK_INTERVAL.count(),
+        .proof_order = GENESIS_BLOCK.proof_order,
+        .reserved_suffix = {}
+    };
+    candidate.data.act({ .vote = 'f' });
+
+    return candidate;
+}
+
+block sign(const block &parent) {
+    block candidate {
+        .version = BLOCK_VERSION,
+        .previous_hash = parent.calculate_hash(),
+        .data = {},
+        .reserved = {},
+        .pow_signature = 0,
+        .pow_extra_signature = 0,
+        .timestamp = std::max(current_timestamp(), parent.timestamp + 1),
+        .proof_order = GENESIS_BLOCK.proof_order, // Height of the block isn't a retarget one
+        .reserved_suffix = {}
+    };
+    candidate.data.act({ .vote = 'm' });
+
+    miner signer(1);
+    signer.start(candidate);
+
+    std::optional<block> signed_block;
+    while (!(signed_block = signer.poll())) {
+        pollfd completion { .fd = signer.completion_fd(), .events = POLLIN, .revents = 0 };
+        poll(&completion, 1, 100);
+    }
+
+    return *signed_block;
+}
+
+bool write_store(const char *directory, const std::vector<block> &chain, const std::vector<hash256_t> &hashes) {
+    block_store store;
+    bool ok = check(store.open(directory), "peer's store wasn't created");
+
+    for (size_t i = 0; i < chain.size(); ++ i)
+        ok &= check(store.append(chain[i], hashes[i]), "block wasn't stored");
+
+    return ok;
+}
+
+// Asks node for its best tip until it's the expected one
+bool wait_for_tip(simulation &net, address node_address, const block &expected, int attempts) {
+    hash256_t expected_hash = expected.calculate_hash();
+
+    for (int attempt = 0; attempt < attempts; ++ attempt) {
+        transaction discover {
+            .magic = BLOCK_MAGIC,
+            .channel = 0,
+            .type = transaction_type::DISCOVER,
+            .sequence_number = 0,
+            .signed_block = {}
+        };
+        net.send(buffer(&discover, get_transaction_size(discover)), node_address);
+
+        usleep(100000);
+
+        transaction reply;
+        address sender;
+        while (net.receive(reply, &sender))
+            if (reply.type == transaction_type::SYNC && reply.signed_block.calculate_hash() == expected_hash)
+                return true;
+    }
+
+    return false;
+}
+
+// Node syncs from a peer that loads `store_directory`, assuming `checkpoint`
+// is valid. Returns false, if it doesn't end up with `expected_votes` for 'f'.
+bool sync_assuming(const char *store_directory, const hash256_t &checkpoint,
+                   const block &tip, uint64_t expected_votes) {
+
+    // Observer is registered first, so it learns addresses of both from their DISCOVERs
+    simulation_builder builder;
+    simulation observer = builder.produce_node();
+
+    blockchain<simulation> peer(-1, 0, builder.produce_node(), 1, store_directory);
+    blockchain<simulation> node(-1, 0, builder.produce_node(), 1);
+    node.assume_valid(checkpoint);
+
+    transaction discover;
+    address peer_address, node_address;
+    if (!observer.receive(discover, &peer_address) || !observer.receive(discover, &node_address)) {
+        fprintf(stderr, "FAIL: nodes didn't broadcast DISCOVER\n");
+        return false;
+    }
+
+    std::thread running_peer([&peer] { peer.run(); });
+    std::thread running_node([&node] { node.run(); });
+
+    // Rejected blocks are only rejected after two sync timeouts, let them pass
+    bool is_synced = wait_for_tip(observer, node_address, tip, expected_votes ? 100 : 80);
+
+    node.stop();
+    peer.stop();
+
+    running_node.join();
+    running_peer.join();
+
+    bool ok = check(is_synced == (expected_votes != 0), "node didn't end up on the expected tip");
+    ok &= check(node.get_vote_counts()['f'] == expected_votes, "unsigned blocks linked, when they shouldn't, or vice versa");
+    ok &= check(node.get_vote_counts()['m'] == (expected_votes ? 1 : 0), "signed block on top wasn't validated");
+    ok &= check(node.get_vote_counts()['x'] == 0, "forged blocks were linked");
+
+    return ok;
+}
+
+} // end anonymous namespace
+
+
+int main() {
+    // Nodes watch their working directory for the act file, they shouldn't find one
+    char directory[] = "/tmp/assume-valid-XXXXXX";
+    if (!mkdtemp(directory) || chdir(directory) != 0) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    std::vector<block> chain = { GENESIS_BLOCK };
+    for (size_t i = 0; i < UNSIGNED_COUNT; ++ i)
+        chain.push_back(make_unsigned(chain.back()));
+
+    bool ok = true;
+    for (size_t i = 1; i < chain.size(); ++ i)
+        ok &= check(!chain[i].verify(), "unsigned block happens to be signed");
+
+    block checkpoint = chain.back();
+    chain.push_back(sign(checkpoint));
+
+    std::vector<hash256_t> hashes;
+    for (const block &stored: chain)
+        hashes.push_back(stored.calculate_hash());
+
+    std::vector<block> forged = chain;
+    for (size_t i = 1; i < UNSIGNED_COUNT; ++ i)
+        if (i % GENUINE_EVERY != 0)
+            forged[i].data.votes[0] = 'x';
+
+    ok &= write_store("peer", chain, hashes);
+    ok &= write_store("forged", forged, hashes);
+
+    ok &= sync_assuming("peer", checkpoint.calculate_hash(), chain.back(), UNSIGNED_COUNT);
+    // Hash that no block has, so the checkpoint is never reached
+    ok &= sync_assuming("peer", hash256_t { 1 }, chain.back(), 0);
+    ok &= sync_assuming("forged", checkpoint.calculate_hash(), chain.back(), 0);
+
+    std::filesystem::remove_all(directory);
+
+    if (!ok)
+        return 1;
+
+    printf("OK: blocks below the checkpoint were linked without checking their PoW, forged ones weren't\n");
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "block-index.h"
+#include "genesis.h"
+
+#include <random>
+#include <vector>
+
+#include <stdio.h>
+
+
+// Ancestors found through skip pointers are the same ones a plain walk
+// over parents finds, at every height, on trees that are mostly long
+// chains, with branches sprouting off at random.
+
+namespace {
+
+bool check(bool condition, const char *what) {
+    if (!condition)
+        fprintf(stderr, "FAIL: %s\n", what);
+
+    return condition;
+}
+
+std::mt19937 generator(20261016);
+
+// Index doesn't look into blocks, or check their hashes, random ones do
+hashed_block random_block() {
+    hash256_t hash;
+    for (uint32_t &word: hash)
+        word = generator();
+
+    return { GENESIS_BLOCK, hash };
+}
+
+block_index random_tree(size_t size, double branch_probability) {
+    block_index tree;
+    tree.add(random_block());
+
+    std::bernoulli_distribution is_branch(branch_probability);
+    for (size_t i = 1; i < size; ++ i) {
+        arranged_block_index parent = is_branch(generator) ? generator() % tree.size() : tree.size() - 1;
+        tree.add(random_block(), parent);
+    }
+
+    return tree;
+}
+
+// Every ancestor of some blocks, from the block itself down to the root
+bool test_every_height(const block_index &tree, size_t blocks_checked) {
+    bool ok = true;
+
+    for (size_t i = 0; i < blocks_checked && ok; ++ i) {
+        arranged_block_index index = generator() % tree.size();
+
+        arranged_block_index walked = index;
+        for (uint64_t height = tree.height(index); ; -- height) {
+            ok &= check(tree.height(walked) == height, "parent isn't one block lower");
+            ok &= check(tree.ancestor(index, height) == walked, "ancestor doesn't match parent walk");
+
+            if (height == 0 || !ok)
+                break;
+
+            walked = tree.parent(walked);
+        }
+    }
+
+    return ok;
+}
+
+// Single random height for every block, ancestors of ancestors included
+bool test_random_heights(const block_index &tree) {
+    bool ok = true;
+
+    for (arranged_block_index index = 0; index < tree.size() && ok; ++ index) {
+        uint64_t height = generator() % (tree.height(index) + 1);
+
+        arranged_block_index walked = index;
+        while (tree.height(walked) > height)
+            walked = tree.parent(walked);
+
+        arranged_block_index found = tree.ancestor(index, height);
+        ok &= check(found == walked, "ancestor at random height doesn't match parent walk");
+        ok &= check(tree.ancestor(found, height) == found, "block isn't its own ancestor at its height");
+    }
+
+    return ok;
+}
+
+} // end anonymous namespace
+
+
+int main() {
+    bool ok = true;
+
+    for (double branch_probability: { 0.0, 0.01, 0.3 }) {
+        block_index tree = random_tree(20000, branch_probability);
+
+        ok &= test_every_height(tree, 200);
+        ok &= test_random_heights(tree);
+    }
+
+    if (!ok)
+        return 1;
+
+    printf("OK: skip pointers lead to the same ancestors as parents\n");
+    return 0;
+}
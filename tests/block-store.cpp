@@ -0,0 +1,203 @@
+#include "block-store.h"
+#include "genesis.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+// Block store is reopened after the kind of damage a crash leaves behind.
+// Blocks whose segment write got lost are forgotten, blocks that got lost
+// in the middle of the store, or a broken index, are reported. Stores are
+// big enough to cross into the second segment, and to grow the index many
+// times over.
+
+namespace {
+
+bool check(bool condition, const char *what) {
+    if (!condition)
+        fprintf(stderr, "FAIL: %s\n", what);
+
+    return condition;
+}
+
+constexpr uint64_t SEGMENT_BLOCKS = block_store::SEGMENT_BLOCKS;
+
+struct stored_blocks {
+    std::vector<block> blocks;
+    std::vector<hash256_t> hashes;
+};
+
+// Chain of distinct blocks, store doesn't care about their proof of work
+stored_blocks make_blocks(size_t count) {
+    stored_blocks made;
+
+    block current = GENESIS_BLOCK;
+    for (size_t i = 0; i < count; ++ i) {
+        current.previous_hash = made.hashes.empty() ? GENESIS_HASH : made.hashes.back();
+        current.timestamp = GENESIS_BLOCK.timestamp + i + 1;
+
+        made.blocks.push_back(current);
+        made.hashes.push_back(current.calculate_hash());
+    }
+
+    return made;
+}
+
+bool write_store(const std::string &directory, const stored_blocks &written) {
+    block_store store;
+    if (!store.open(directory.c_str()))
+        return false;
+
+    for (size_t i = 0; i < written.blocks.size(); ++ i)
+        if (!store.append(written.blocks[i], written.hashes[i]))
+            return false;
+
+    return true;
+}
+
+// Checks that store loads exactly the first `count` written blocks, in order
+bool loads_prefix(block_store &store, const stored_blocks &written, size_t count) {
+    size_t loaded = 0;
+    bool is_same = true;
+
+    bool is_loaded = store.load([&](const block &stored, const hash256_t &hash) {
+        is_same &= loaded < count
+            && memcmp(&stored, &written.blocks[loaded], sizeof(block)) == 0
+            && hash == written.hashes[loaded];
+
+        ++ loaded;
+    });
+
+    return is_loaded && is_same && loaded == count;
+}
+
+std::string segment_path(const std::string &directory, uint64_t segment) {
+    char name[32];
+    snprintf(name, sizeof(name), "/segment-%05llu", (unsigned long long) segment);
+
+    return directory + name;
+}
+
+// Second segment gets a few blocks, index grows from its initial 4096 entries
+const size_t CROSSING_COUNT = SEGMENT_BLOCKS + 1000;
+
+bool test_reopen(const std::string &directory, const stored_blocks &written) {
+    bool ok = check(write_store(directory, written), "blocks weren't written");
+
+    ok &= check(std::filesystem::exists(segment_path(directory, 1)), "blocks didn't cross into the second segment");
+
+    block_store store;
+    ok &= check(store.open(directory.c_str()), "store wasn't reopened");
+    ok &= check(store.size() == written.blocks.size(), "reopened store lost blocks");
+    ok &= check(loads_prefix(store, written, written.blocks.size()), "reopened store doesn't load written blocks");
+
+    // Index keeps growing after it was reopened at its grown size
+    stored_blocks more = make_blocks(written.blocks.size() + 5000);
+    for (size_t i = written.blocks.size(); i < more.blocks.size(); ++ i)
+        ok &= check(store.append(more.blocks[i], more.hashes[i]), "block wasn't appended after reopening");
+
+    store.close();
+
+    ok &= check(store.open(directory.c_str()), "store wasn't reopened after growing");
+    ok &= check(loads_prefix(store, more, more.blocks.size()), "blocks appended after reopening are lost");
+
+    return ok;
+}
+
+// Index entry is written after its block, but a crash of the system can
+// lose the block anyway. Store has to forget such entries when reopened.
+bool test_lost_tail(const std::string &directory, const stored_blocks &written) {
+    bool ok = check(write_store(directory, written), "blocks weren't written");
+
+    // Second segment is lost entirely, and half of its last block with the first one
+    std::filesystem::remove(segment_path(directory, 1));
+    ok &= check(truncate(segment_path(directory, 0).c_str(), SEGMENT_BLOCKS * sizeof(block) - sizeof(block) / 2) == 0,
+                "segment wasn't truncated");
+
+    block_store store;
+    ok &= check(store.open(directory.c_str()), "store with lost blocks wasn't reopened");
+    ok &= check(store.size() == SEGMENT_BLOCKS - 1, "entries of lost blocks weren't trimmed");
+    ok &= check(loads_prefix(store, written, SEGMENT_BLOCKS - 1), "blocks before lost ones aren't loaded");
+
+    // Lost blocks are received again, and written where they were
+    for (size_t i = SEGMENT_BLOCKS - 1; i < written.blocks.size(); ++ i)
+        ok &= check(store.append(written.blocks[i], written.hashes[i]), "lost block wasn't appended again");
+
+    store.close();
+
+    ok &= check(store.open(directory.c_str()), "store wasn't reopened after rewriting lost blocks");
+    ok &= check(loads_prefix(store, written, written.blocks.size()), "rewritten blocks aren't loaded");
+
+    return ok;
+}
+
+// Blocks lost before the last segment can't be just forgotten, their
+// children are still in the store. Loading them has to fail instead.
+bool test_lost_middle(const std::string &directory, const stored_blocks &written) {
+    bool ok = check(write_store(directory, written), "blocks weren't written");
+
+    ok &= check(truncate(segment_path(directory, 0).c_str(), SEGMENT_BLOCKS / 2 * sizeof(block)) == 0,
+                "segment wasn't truncated");
+
+    block_store store;
+    ok &= check(store.open(directory.c_str()), "store with lost blocks wasn't reopened");
+    ok &= check(store.size() == written.blocks.size(), "entries were trimmed though the last segment is complete");
+
+    size_t loaded = 0;
+    ok &= check(!store.load([&](const block&, const hash256_t&) { ++ loaded; }), "truncated segment was loaded");
+    ok &= check(loaded == SEGMENT_BLOCKS / 2, "blocks before truncated part weren't loaded");
+
+    return ok;
+}
+
+bool test_broken_index(const std::string &directory, const stored_blocks &written) {
+    bool ok = check(write_store(directory, written), "blocks weren't written");
+
+    std::string index_path = directory + "/index";
+    block_store store;
+
+    // Index lost entries it still counts
+    ok &= check(truncate(index_path.c_str(), 10000 * (sizeof(hash256_t) + sizeof(uint64_t))) == 0,
+                "index wasn't truncated");
+    ok &= check(!store.open(directory.c_str()), "store with truncated index was opened");
+
+    // Index lost even its header
+    ok &= check(truncate(index_path.c_str(), 8) == 0, "index wasn't truncated");
+    ok &= check(!store.open(directory.c_str()), "store with truncated index header was opened");
+    ok &= check(!store.is_open(), "store stayed open after failing to open");
+
+    return ok;
+}
+
+} // end anonymous namespace
+
+
+int main() {
+    char directory[] = "/tmp/block-store-XXXXXX";
+    if (!mkdtemp(directory)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    stored_blocks written = make_blocks(CROSSING_COUNT);
+
+    std::string root = directory;
+    bool ok = test_reopen(root + "/reopen", written);
+    ok &= test_lost_tail(root + "/lost-tail", written);
+    ok &= test_lost_middle(root + "/lost-middle", written);
+    ok &= test_broken_index(root + "/broken-index", written);
+
+    std::filesystem::remove_all(root);
+
+    if (!ok)
+        return 1;
+
+    printf("OK: block store recovers from lost blocks, and reports what it can't recover\n");
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include "simulation.h"
+#include "blockchain.h"
+#include "miner.h"
+
+#include <thread>
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+// Node gets two children of genesis from a peer, first one with the same
+// timestamp as genesis. If it were accepted, it would stay the best tip,
+// because the second one has no more work than it. So best tip the node
+// reports back has to be the second one.
+
+namespace {
+
+block sign(miner &signer, uint64_t timestamp, uint8_t vote) {
+    block candidate {
+        .version = BLOCK_VERSION,
+        .previous_hash = GENESIS_HASH,
+        .data = {},
+        .reserved = {},
+        .pow_signature = 0,
+        .pow_extra_signature = 0,
+        .timestamp = timestamp,
+        .proof_order = GENESIS_BLOCK.proof_order,
+        .reserved_suffix = {}
+    };
+    candidate.data.act({ .vote = (char) vote });
+
+    signer.start(candidate);
+
+    std::optional<block> signed_block;
+    while (!(signed_block = signer.poll())) {
+        pollfd completion { .fd = signer.completion_fd(), .events = POLLIN, .revents = 0 };
+        poll(&completion, 1, 100);
+    }
+
+    return *signed_block;
+}
+
+// Asks node for its best tip until it's something other than genesis
+std::optional<hash256_t> wait_for_tip(simulation &peer, address node_address) {
+    for (int attempt = 0; attempt < 100; ++ attempt) {
+        transaction discover {
+            .magic = BLOCK_MAGIC,
+            .channel = 0,
+            .type = transaction_type::DISCOVER,
+            .sequence_number = 0,
+            .signed_block = {}
+        };
+        peer.send(buffer(&discover, get_transaction_size(discover)), node_address);
+
+        usleep(50000);
+
+        transaction reply;
+        address sender;
+        while (peer.receive(reply, &sender)) {
+            if (reply.type != transaction_type::SYNC)
+                continue;
+
+            hash256_t tip = reply.signed_block.calculate_hash();
+            if (tip != GENESIS_HASH)
+                return tip;
+        }
+    }
+
+    return std::nullopt;
+}
+
+} // end anonymous namespace
+
+
+int main() {
+    // Node watches its working directory for the act file, it shouldn't find one
+    char directory[] = "/tmp/block-timestamps-XXXXXX";
+    if (!mkdtemp(directory) || chdir(directory) != 0) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    // Peer is registered first, so that it hears DISCOVER node starts with
+    static simulation_builder builder;
+    simulation peer = builder.produce_node();
+    static blockchain<simulation> node(-1, 0, builder.produce_node(), 1);
+
+    transaction discover;
+    address node_address;
+    if (!peer.receive(discover, &node_address)) {
+        fprintf(stderr, "FAIL: node didn't broadcast DISCOVER\n");
+        return 1;
+    }
+
+    std::thread([] { node.run(); }).detach();
+
+    miner signer(std::thread::hardware_concurrency());
+    block back_dated = sign(signer, GENESIS_BLOCK.timestamp, 'a');
+    block valid = sign(signer, current_timestamp(), 'b');
+
+    uint32_t sequence_number = 0;
+    for (const block &signed_block: { back_dated, valid }) {
+        transaction notify {
+            .channel = 0,
+            .type = transaction_type::NOTIFY_SIGNED,
+            .sequence_number = sequence_number ++,
+            .signed_block = signed_block
+        };
+        peer.send(buffer(&notify, get_transaction_size(notify)), node_address);
+    }
+
+    std::optional<hash256_t> tip = wait_for_tip(peer, node_address);
+    rmdir(directory);
+
+    if (!tip) {
+        fprintf(stderr, "FAIL: node accepted neither of the blocks\n");
+        _exit(1);
+    }
+
+    if (*tip != valid.calculate_hash()) {
+        fprintf(stderr, "FAIL: node accepted back-dated block\n");
+        _exit(1);
+    }
+
+    printf("OK: back-dated block was rejected\n");
+    fflush(stdout);
+    _exit(0); // Node runs forever, it isn't joined
+}
@@ -0,0 +1,204 @@
+#include "hash-map.h"
+
+#include <random>
+#include <vector>
+
+#include <stdio.h>
+
+
+// hash256_map keeps working through growth, erasures and rehashes that only
+// clear tombstones, including when many keys land in the same groups, or
+// even have the same tags there.
+
+namespace {
+
+bool check(bool condition, const char *what) {
+    if (!condition)
+        fprintf(stderr, "FAIL: %s\n", what);
+
+    return condition;
+}
+
+std::mt19937 generator(20261016);
+
+hash256_t random_key() {
+    hash256_t key;
+    for (uint32_t &word: key)
+        word = generator();
+
+    return key;
+}
+
+// Keys with the same words 7 and 6 start probing from the same group, with
+// the same word 5 they also have the same tag. Rest of the words are the
+// same too, except one, so that keys are told apart only by comparing them whole.
+hash256_t colliding_key(uint32_t distinct, bool is_same_tag) {
+    hash256_t key = { 0x11111111, 0x22222222, distinct, 0x44444444,
+                      0x55555555, 0x42, 0x12345678, 0x9abcdef0 };
+
+    if (!is_same_tag)
+        key[5] = generator();
+
+    return key;
+}
+
+bool has_all(const hash256_map<size_t> &map, const std::vector<hash256_t> &keys, size_t first_value = 0) {
+    for (size_t i = 0; i < keys.size(); ++ i) {
+        const size_t *value = map.find(keys[i]);
+        if (!value || *value != first_value + i)
+            return false;
+    }
+
+    return true;
+}
+
+bool has_none(const hash256_map<size_t> &map, const std::vector<hash256_t> &keys) {
+    for (const hash256_t &key: keys)
+        if (map.contains(key))
+            return false;
+
+    return true;
+}
+
+bool test_growth() {
+    hash256_map<size_t> map;
+    std::vector<hash256_t> keys;
+
+    bool ok = true;
+    size_t growths = 0;
+
+    for (size_t i = 0; i < 100000; ++ i) {
+        size_t capacity = map.capacity();
+
+        keys.push_back(random_key());
+        ok &= check(map.insert(keys.back(), i), "new key wasn't inserted");
+
+        if (map.capacity() != capacity) {
+            ++ growths;
+
+            // Everything has to be moved over to the new slots:
+            ok &= check(has_all(map, keys), "keys got lost while growing");
+            ok &= check(map.size() * 8 <= map.capacity() * 7, "table is too full after growing");
+        }
+    }
+
+    ok &= check(growths > 10, "table didn't grow");
+    ok &= check(map.size() == keys.size(), "size doesn't count inserted keys");
+    ok &= check(has_all(map, keys), "inserted keys aren't found");
+    ok &= check(!map.insert(keys[0], 1), "duplicate key was inserted");
+    ok &= check(*map.find(keys[0]) == 0, "duplicate insert changed the value");
+
+    std::vector<hash256_t> missing;
+    for (size_t i = 0; i < 1000; ++ i)
+        missing.push_back(random_key());
+
+    ok &= check(has_none(map, missing), "keys that weren't inserted are found");
+    return ok;
+}
+
+// Colliding keys fill their first group, and spill over to the next ones
+// in the probe sequence. Once early ones are erased, later ones are found
+// only if probes go on past the tombstones.
+bool test_erase(bool is_same_tag) {
+    hash256_map<size_t> map;
+    std::vector<hash256_t> erased, kept;
+
+    for (uint32_t i = 0; i < 20; ++ i)
+        erased.push_back(colliding_key(i, is_same_tag));
+
+    for (uint32_t i = 20; i < 40; ++ i)
+        kept.push_back(colliding_key(i, is_same_tag));
+
+    bool ok = true;
+    for (size_t i = 0; i < erased.size(); ++ i)
+        ok &= check(map.insert(erased[i], i), "colliding key wasn't inserted");
+
+    for (size_t i = 0; i < kept.size(); ++ i)
+        ok &= check(map.insert(kept[i], erased.size() + i), "colliding key wasn't inserted");
+
+    ok &= check(has_all(map, erased) && has_all(map, kept, erased.size()), "colliding keys aren't found");
+
+    size_t capacity = map.capacity();
+    for (const hash256_t &key: erased)
+        ok &= check(map.erase(key), "inserted key wasn't erased");
+
+    ok &= check(!map.erase(erased[0]), "erased key was erased again");
+    ok &= check(map.size() == kept.size(), "size doesn't count erased keys");
+    ok &= check(map.tombstones() == erased.size(), "erased keys didn't leave tombstones");
+
+    ok &= check(has_none(map, erased), "erased keys are found");
+    ok &= check(has_all(map, kept, erased.size()), "keys after tombstones aren't found");
+
+    // Same number of colliding keys take the slots erased ones had:
+    std::vector<hash256_t> reinserted;
+    for (uint32_t i = 40; i < 60; ++ i)
+        reinserted.push_back(colliding_key(i, is_same_tag));
+
+    for (size_t i = 0; i < reinserted.size(); ++ i)
+        ok &= check(map.insert(reinserted[i], 100 + i), "key wasn't inserted over a tombstone");
+
+    ok &= check(map.tombstones() == 0, "tombstones weren't reused");
+    ok &= check(map.capacity() == capacity, "table grew while there were tombstones to reuse");
+
+    ok &= check(has_all(map, reinserted, 100), "keys put over tombstones aren't found");
+    ok &= check(has_all(map, kept, erased.size()), "keys after reused tombstones aren't found");
+    ok &= check(has_none(map, erased), "erased keys are found after reuse");
+
+    return ok;
+}
+
+// Erasing one key and inserting another keeps size constant, but fills
+// the table with tombstones. They have to be cleared by rehashing into the
+// same number of slots, not by growing.
+bool test_churn() {
+    hash256_map<size_t> map;
+    std::vector<hash256_t> keys;
+
+    for (size_t i = 0; i < 1000; ++ i) {
+        keys.push_back(random_key());
+        map.insert(keys.back(), i);
+    }
+
+    size_t capacity = map.capacity();
+    size_t cleared = 0;
+
+    bool ok = true;
+    for (size_t round = 0; round < 100000; ++ round) {
+        size_t victim = generator() % keys.size();
+        size_t tombstones = map.tombstones();
+
+        ok &= check(map.erase(keys[victim]), "key wasn't erased");
+
+        keys[victim] = random_key();
+        ok &= check(map.insert(keys[victim], victim), "key wasn't inserted");
+
+        if (map.tombstones() < tombstones)
+            ++ cleared;
+
+        if (!ok)
+            break;
+    }
+
+    ok &= check(map.capacity() == capacity, "table grew while its size stayed the same");
+    ok &= check(cleared > 0, "tombstones were never cleared");
+    ok &= check(map.size() == keys.size(), "size changed");
+    ok &= check(has_all(map, keys), "keys got lost while clearing tombstones");
+
+    return ok;
+}
+
+} // end anonymous namespace
+
+
+int main() {
+    bool ok = test_growth();
+    ok &= test_erase(false);
+    ok &= test_erase(true);
+    ok &= test_churn();
+
+    if (!ok)
+        return 1;
+
+    printf("OK: hash256_map keeps all of its keys\n");
+    return 0;
+}
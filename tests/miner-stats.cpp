@@ -0,0 +1,206 @@
+#include "genesis.h"
+#include "miner.h"
+
+#include <numeric>
+#include <optional>
+
+#include <poll.h>
+#include <stdio.h>
+#include <unistd.h>
+
+
+// Miner counts hashes as wasted only when the block they were spent on got
+// replaced, and keeps time-to-solution per thread, merging it on read. Job
+// that gets paused goes on from where it stopped, rather than from scratch.
+
+namespace {
+
+constexpr unsigned NUM_THREADS = 2;
+constexpr unsigned NUM_SOLVED_JOBS = 8;
+
+bool check(bool condition, const char *what) {
+    if (!condition)
+        fprintf(stderr, "FAIL: %s\n", what);
+
+    return condition;
+}
+
+block make_candidate(uint32_t proof_order, uint64_t timestamp) {
+    block candidate = GENESIS_BLOCK;
+    candidate.previous_hash = GENESIS_HASH;
+    candidate.proof_order = proof_order;
+    candidate.timestamp = timestamp;
+    return candidate;
+}
+
+uint64_t total(const mining_stats &stats, uint64_t mining_stats::thread_stats::*counter) {
+    uint64_t sum = 0;
+    for (const auto &thread: stats.threads)
+        sum += thread.*counter;
+
+    return sum;
+}
+
+uint64_t total(const mining_stats::histogram &histogram) {
+    return std::accumulate(histogram.begin(), histogram.end(), uint64_t(0));
+}
+
+// Job that is never going to be solved, for a little while
+void run_hopeless_job(miner &signer, uint64_t timestamp) {
+    signer.start(make_candidate(MAX_PROOF_ORDER, timestamp));
+    usleep(20000);
+}
+
+bool test_cancel_reasons() {
+    miner signer(NUM_THREADS);
+    bool ok = true;
+
+    run_hopeless_job(signer, 1);
+    signer.cancel();
+    mining_stats stopped = signer.stats();
+    ok &= check(total(stopped, &mining_stats::thread_stats::hashes) > 0, "hopeless job did no hashes");
+    ok &= check(total(stopped, &mining_stats::thread_stats::wasted_hashes) == 0, "stopped job counted as wasted");
+
+    // Timed out job, that gets superseded by the next one, isn't a waste either
+    signer.start(make_candidate(MAX_PROOF_ORDER, 2), std::chrono::milliseconds(10));
+    while (signer.is_running())
+        usleep(1000);
+
+    run_hopeless_job(signer, 3);
+    signer.cancel();
+    mining_stats timed_out = signer.stats();
+    ok &= check(total(timed_out, &mining_stats::thread_stats::wasted_hashes) == 0, "timed out job counted as wasted");
+
+    run_hopeless_job(signer, 4);
+    signer.cancel(miner::cancel_reason::BLOCK_REPLACED);
+    mining_stats replaced = signer.stats();
+
+    uint64_t job_hashes = total(replaced, &mining_stats::thread_stats::hashes)
+                        - total(timed_out, &mining_stats::thread_stats::hashes);
+    ok &= check(job_hashes > 0, "replaced job did no hashes");
+    ok &= check(total(replaced, &mining_stats::thread_stats::wasted_hashes) == job_hashes,
+                "replaced job isn't counted as wasted exactly");
+
+    for (size_t i = 0; i < NUM_THREADS; ++ i) {
+        ok &= check(replaced.threads[i].wasted_hashes
+                        == replaced.threads[i].hashes - timed_out.threads[i].hashes,
+                    "wasted hashes are attributed to the wrong thread");
+    }
+
+    return ok;
+}
+
+block wait_for_signed(miner &signer) {
+    std::optional<block> signed_block;
+    while (!(signed_block = signer.poll())) {
+        pollfd completion { .fd = signer.completion_fd(), .events = POLLIN, .revents = 0 };
+        poll(&completion, 1, 100);
+    }
+
+    return *signed_block;
+}
+
+// Single thread walks signatures in order, so it does exactly as many
+// hashes as it takes to get to the first one that signs the block, however
+// many times it's paused on the way, unless it tries some ranges twice
+bool test_pause() {
+    constexpr uint64_t MIN_HASHES = 1 << 20; // Enough for a few pauses
+    constexpr unsigned MAX_PAUSES = 8;
+
+    miner reference(1);
+
+    block candidate, expected;
+    uint64_t expected_hashes = 0;
+    for (uint64_t timestamp = 0; expected_hashes < MIN_HASHES; ++ timestamp) {
+        uint64_t before = total(reference.stats(), &mining_stats::thread_stats::hashes);
+
+        candidate = make_candidate(PROOF_ORDER, timestamp);
+        reference.start(candidate);
+        expected = wait_for_signed(reference);
+
+        expected_hashes = total(reference.stats(), &mining_stats::thread_stats::hashes) - before;
+    }
+
+    miner signer(1);
+    signer.start(candidate);
+
+    bool ok = true;
+    unsigned pauses = 0;
+
+    std::optional<block> signed_block;
+    while (pauses < MAX_PAUSES) {
+        usleep(20000);
+
+        signer.pause();
+        if ((signed_block = signer.poll()))
+            break;
+
+        ok &= check(!signer.is_running(), "paused job is still running");
+        ++ pauses;
+
+        uint64_t paused_hashes = total(signer.stats(), &mining_stats::thread_stats::hashes);
+        usleep(5000);
+        ok &= check(total(signer.stats(), &mining_stats::thread_stats::hashes) == paused_hashes,
+                    "paused job is still hashing");
+
+        signer.resume();
+    }
+
+    if (!signed_block)
+        signed_block = wait_for_signed(signer);
+
+    mining_stats stats = signer.stats();
+
+    ok &= check(pauses > 0, "job was solved before it got paused");
+    ok &= check(signed_block->pow_signature == expected.pow_signature
+                    && signed_block->pow_extra_signature == expected.pow_extra_signature,
+                "paused job found another signature");
+    ok &= check(total(stats, &mining_stats::thread_stats::hashes) == expected_hashes,
+                "paused job tried some signatures twice");
+    ok &= check(stats.jobs_cancelled == 0, "paused job counted as cancelled");
+
+    return ok;
+}
+
+bool test_time_to_solution() {
+    miner signer(NUM_THREADS);
+
+    for (unsigned i = 0; i < NUM_SOLVED_JOBS; ++ i) {
+        signer.start(make_candidate(MIN_PROOF_ORDER, i));
+        wait_for_signed(signer);
+    }
+
+    mining_stats stats = signer.stats();
+    bool ok = true;
+
+    ok &= check(stats.jobs_solved == NUM_SOLVED_JOBS, "solved jobs aren't counted");
+    ok &= check(total(stats.time_to_solution) == NUM_SOLVED_JOBS, "merged histogram misses solutions");
+    ok &= check(total(stats, &mining_stats::thread_stats::wasted_hashes) == 0, "solved jobs counted as wasted");
+
+    mining_stats::histogram merged {};
+    for (const auto &thread: stats.threads) {
+        ok &= check(total(thread.time_to_solution) == thread.solutions,
+                    "thread histogram doesn't match its solutions");
+
+        for (size_t i = 0; i < merged.size(); ++ i)
+            merged[i] += thread.time_to_solution[i];
+    }
+
+    ok &= check(merged == stats.time_to_solution, "merged histogram isn't a sum of thread ones");
+    return ok;
+}
+
+} // end anonymous namespace
+
+
+int main() {
+    bool ok = test_cancel_reasons();
+    ok &= test_time_to_solution();
+    ok &= test_pause();
+
+    if (!ok)
+        return 1;
+
+    printf("OK: mining stats are accounted correctly\n");
+    return 0;
+}
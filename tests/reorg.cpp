@@ -0,0 +1,212 @@
+#include "simulation.h"
+#include "blockchain.h"
+#include "miner.h"
+
+#include <array>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+// Node gets two competing branches from a peer, one bit at a time, so that
+// its best tip has to switch from one branch to the other and back:
+//
+//   genesis - a1 - a2 ............ - a3 - a4
+//          \                              (a4 wins in the end)
+//           - b1 - b2 - b3                (b3 wins first)
+//
+// After every switch, best tip is asked for over the network, and it has
+// to be the tip of the branch with the most work. Vote tally, which node
+// updates incrementally, has to match votes counted from scratch, by
+// walking the winning branch down to genesis.
+
+namespace {
+
+bool check(bool condition, const char *what) {
+    if (!condition)
+        fprintf(stderr, "FAIL: %s\n", what);
+
+    return condition;
+}
+
+class peer_node {
+public:
+    peer_node(simulation &net, address node_address):
+        net_(net),
+        node_address_(node_address),
+        signer_(1),
+        sequence_number_(1) {
+    }
+
+    block sign(const block &parent, uint8_t vote) {
+        block candidate {
+            .version = BLOCK_VERSION,
+            .previous_hash = parent.calculate_hash(),
+            .data = {},
+            .reserved = {},
+            .pow_signature = 0,
+            .pow_extra_signature = 0,
+            .timestamp = std::max(current_timestamp(), parent.timestamp + 1),
+            .proof_order = GENESIS_BLOCK.proof_order, // Branches are too short to retarget
+            .reserved_suffix = {}
+        };
+        candidate.data.act({ .vote = (char) vote });
+
+        signer_.start(candidate);
+
+        std::optional<block> signed_block;
+        while (!(signed_block = signer_.poll())) {
+            pollfd completion { .fd = signer_.completion_fd(), .events = POLLIN, .revents = 0 };
+            poll(&completion, 1, 100);
+        }
+
+        return *signed_block;
+    }
+
+    void notify(const block &signed_block) {
+        transaction notify {
+            .channel = 0,
+            .type = transaction_type::NOTIFY_SIGNED,
+            .sequence_number = sequence_number_ ++,
+            .signed_block = signed_block
+        };
+        net_.send(buffer(&notify, get_transaction_size(notify)), node_address_);
+    }
+
+    // Asks node for its best tip until it's the expected one
+    bool wait_for_tip(const block &expected) {
+        hash256_t expected_hash = expected.calculate_hash();
+
+        for (int attempt = 0; attempt < 100; ++ attempt) {
+            transaction discover {
+                .magic = BLOCK_MAGIC,
+                .channel = 0,
+                .type = transaction_type::DISCOVER,
+                .sequence_number = 0,
+                .signed_block = {}
+            };
+            net_.send(buffer(&discover, get_transaction_size(discover)), node_address_);
+            sequence_number_ = 1; // DISCOVER starts counting over
+
+            usleep(50000);
+
+            transaction reply;
+            address sender;
+            while (net_.receive(reply, &sender))
+                if (reply.type == transaction_type::SYNC && reply.signed_block.calculate_hash() == expected_hash)
+                    return true;
+        }
+
+        return false;
+    }
+
+private:
+    simulation &net_;
+    address node_address_;
+
+    miner signer_;
+    uint32_t sequence_number_;
+};
+
+using vote_counts = std::array<uint64_t, 256>;
+
+vote_counts count_votes(const std::map<hash256_t, block> &blocks, const block &tip) {
+    vote_counts counts {};
+
+    for (hash256_t hash = tip.calculate_hash(); hash != GENESIS_HASH; ) {
+        const block &current = blocks.at(hash);
+        for (int i = 0; i < current.data.count_votes; ++ i)
+            ++ counts[(unsigned char) current.data.votes[i]];
+
+        hash = current.previous_hash;
+    }
+
+    return counts;
+}
+
+char find_winner(const vote_counts &counts) {
+    char winner = '0';
+    for (int candidate = 0; candidate < 256; ++ candidate)
+        if (counts[candidate] > counts[(unsigned char) winner])
+            winner = candidate;
+
+    return winner;
+}
+
+} // end anonymous namespace
+
+
+int main() {
+    // Node watches its working directory for the act file, it shouldn't find one
+    char directory[] = "/tmp/reorg-XXXXXX";
+    if (!mkdtemp(directory) || chdir(directory) != 0) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    // Peer is registered first, so that it hears DISCOVER node starts with
+    simulation_builder builder;
+    simulation net = builder.produce_node();
+    blockchain<simulation> node(-1, 0, builder.produce_node(), 1);
+
+    transaction discover;
+    address node_address;
+    if (!net.receive(discover, &node_address)) {
+        fprintf(stderr, "FAIL: node didn't broadcast DISCOVER\n");
+        return 1;
+    }
+
+    peer_node peer(net, node_address);
+
+    block a1 = peer.sign(GENESIS_BLOCK, 'a'), a2 = peer.sign(a1, 'a');
+    block b1 = peer.sign(GENESIS_BLOCK, 'b'), b2 = peer.sign(b1, 'b'), b3 = peer.sign(b2, 'c');
+    block a3 = peer.sign(a2, 'c'), a4 = peer.sign(a3, 'a');
+
+    std::map<hash256_t, block> blocks;
+    for (const block &signed_block: { a1, a2, a3, a4, b1, b2, b3 })
+        blocks[signed_block.calculate_hash()] = signed_block;
+
+    struct phase {
+        const char *name;
+        std::vector<block> sent;
+        block expected_tip;
+    };
+
+    const phase phases[] = {
+        { "first branch",                   { a1, a2 },     a2 },
+        { "switch to the longer branch",    { b1, b2, b3 }, b3 },
+        { "switch back to the first one",   { a3, a4 },     a4 },
+    };
+
+    bool ok = true;
+    for (const phase &current: phases) {
+        std::thread running([&node] { node.run(); });
+
+        for (const block &sent: current.sent)
+            peer.notify(sent);
+
+        bool is_switched = peer.wait_for_tip(current.expected_tip);
+
+        node.stop();
+        running.join();
+
+        ok &= check(is_switched, current.name);
+
+        // Node isn't running, so its tally can be looked at
+        vote_counts expected = count_votes(blocks, current.expected_tip);
+        ok &= check(node.get_vote_counts() == expected, "vote tally doesn't match recount");
+        ok &= check(node.who_wins() == find_winner(expected), "winner doesn't match recount");
+    }
+
+    rmdir(directory);
+
+    if (!ok)
+        return 1;
+
+    printf("OK: best tip and its votes followed the branch with the most work\n");
+}
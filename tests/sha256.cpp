@@ -0,0 +1,392 @@
+#include "block.h"
+#include "crypto.h"
+
+#include <algorithm>
+#include <array>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+// Messages from NIST FIPS 180-2 examples, and messages of lengths at which
+// padding changes: it fits into the last block up to 55 bytes, takes one
+// more block from 56, and 64 fills the block with data exactly.
+struct known_answer {
+    std::string message;
+    uint32_t hash[HASH_SIZE];
+};
+
+const known_answer KNOWN_ANSWERS[] = {
+    { "", { 0xe3b0c442, 0x98fc1c14, 0x9afbf4c8, 0x996fb924, 0x27ae41e4, 0x649b934c, 0xa495991b, 0x7852b855 } },
+    { "abc", { 0xba7816bf, 0x8f01cfea, 0x414140de, 0x5dae2223, 0xb00361a3, 0x96177a9c, 0xb410ff61, 0xf20015ad } },
+
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+      { 0x248d6a61, 0xd20638b8, 0xe5c02693, 0x0c3e6039, 0xa33ce459, 0x64ff2167, 0xf6ecedd4, 0x19db06c1 } },
+
+    { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+      { 0xcf5b16a7, 0x78af8380, 0x036ce59e, 0x7b049237, 0x0b249b11, 0xe8f07a51, 0xafac4503, 0x7afee9d1 } },
+
+    { std::string(55, 'a'), { 0x9f4390f8, 0xd30c2dd9, 0x2ec9f095, 0xb65e2b9a, 0xe9b0a925, 0xa5258e24, 0x1c9f1e91, 0x0f734318 } },
+    { std::string(56, 'a'), { 0xb35439a4, 0xac6f0948, 0xb6d6f9e3, 0xc6af0f5f, 0x590ce20f, 0x1bde7090, 0xef797068, 0x6ec6738a } },
+    { std::string(63, 'a'), { 0x7d3e74a0, 0x5d7db15b, 0xce4ad9ec, 0x0658ea98, 0xe3f06eee, 0xcf16b4c6, 0xfff2da45, 0x7ddc2f34 } },
+    { std::string(64, 'a'), { 0xffe054fe, 0x7ae0cb6d, 0xc65c3af9, 0xb61d5209, 0xf439851d, 0xb43d0ba5, 0x997337df, 0x154668eb } },
+    { std::string(65, 'a'), { 0x635361c4, 0x8bb9eab1, 0x4198e76e, 0xa8ab7f1a, 0x41685d6a, 0xd62aa914, 0x6d301d4f, 0x17eb0ae0 } },
+
+    { std::string(1000000, 'a'),
+      { 0xcdc76e5c, 0x9914fb92, 0x81a1c7e2, 0x84d73e67, 0xf1809a48, 0xa497200e, 0x046d39cc, 0xc7112cd0 } },
+};
+
+int failures = 0;
+
+void check(bool is_correct, const char* what, size_t size) {
+    if (!is_correct) {
+        fprintf(stderr, "FAIL: %s, message of %zu bytes\n", what, size);
+        ++ failures;
+    }
+}
+
+bool is_same_hash(const uint32_t first[HASH_SIZE], const uint32_t second[HASH_SIZE]) {
+    return memcmp(first, second, HASH_SIZE * sizeof(uint32_t)) == 0;
+}
+
+// Bytes that don't repeat with the period of a block or a word
+std::vector<unsigned char> make_sample(size_t size) {
+    std::vector<unsigned char> sample(size);
+    for (size_t i = 0; i < size; ++ i)
+        sample[i] = (unsigned char) (i * 167 + 13);
+
+    return sample;
+}
+
+// Largest sample checked against the one-shot hash, covers every padding case
+// for one, two and three blocks
+constexpr size_t MAX_SAMPLE_SIZE = 3 * SHA_256_BLOCK_SIZE;
+
+
+void test_known_answers() {
+    for (const known_answer &answer: KNOWN_ANSWERS) {
+        uint32_t hash[HASH_SIZE];
+        hash_with_sha_256(answer.message.data(), answer.message.size(), hash);
+
+        check(is_same_hash(hash, answer.hash), "hash_with_sha_256 doesn't match known answer", answer.message.size());
+    }
+}
+
+// Pads message the way the specification does, independent of the library
+std::vector<unsigned char> pad_message(const unsigned char* data, size_t size) {
+    std::vector<unsigned char> padded(data, data + size);
+    padded.push_back(0x80);
+
+    while (padded.size() % SHA_256_BLOCK_SIZE != SHA_256_BLOCK_SIZE - sizeof(uint64_t))
+        padded.push_back(0);
+
+    for (int i = sizeof(uint64_t) - 1; i >= 0; -- i)
+        padded.push_back((unsigned char) ((uint64_t) size * 8 >> (8 * i)));
+
+    return padded;
+}
+
+void hash_with_compressor(const sha_256_compressor &compressor, const unsigned char* data, size_t size,
+                          uint32_t output_hash[HASH_SIZE]) {
+
+    memcpy(output_hash, SHA_256_INITIAL_HASH, sizeof(SHA_256_INITIAL_HASH));
+
+    std::vector<unsigned char> padded = pad_message(data, size);
+    for (size_t offset = 0; offset < padded.size(); offset += SHA_256_BLOCK_SIZE) {
+        uint32_t message[64];
+        load_sha_256_block(padded.data() + offset, message);
+
+        compressor.compress(message, output_hash);
+    }
+}
+
+// Each backend gets the known answers, and then has to agree with the
+// scalar one on every size, whichever of them ends up selected
+void test_compressors() {
+    std::vector<sha_256_compressor> compressors = get_sha_256_compressors();
+    const sha_256_compressor &scalar = compressors.front();
+
+    std::vector<unsigned char> sample = make_sample(MAX_SAMPLE_SIZE);
+
+    for (const sha_256_compressor &compressor: compressors) {
+        std::string what = std::string(compressor.name) + " backend doesn't match known answer";
+
+        for (const known_answer &answer: KNOWN_ANSWERS) {
+            uint32_t hash[HASH_SIZE];
+            hash_with_compressor(compressor, (const unsigned char*) answer.message.data(), answer.message.size(), hash);
+
+            check(is_same_hash(hash, answer.hash), what.c_str(), answer.message.size());
+        }
+
+        what = std::string(compressor.name) + " backend doesn't match scalar one";
+        for (size_t size = 0; size <= MAX_SAMPLE_SIZE; ++ size) {
+            uint32_t expected[HASH_SIZE], actual[HASH_SIZE];
+
+            hash_with_compressor(scalar,     sample.data(), size, expected);
+            hash_with_compressor(compressor, sample.data(), size, actual);
+
+            check(is_same_hash(actual, expected), what.c_str(), size);
+        }
+    }
+
+    // Selected backend, through the library's own padding:
+    for (size_t size = 0; size <= MAX_SAMPLE_SIZE; ++ size) {
+        uint32_t expected[HASH_SIZE], actual[HASH_SIZE];
+
+        hash_with_compressor(scalar, sample.data(), size, expected);
+        hash_with_sha_256(sample.data(), size, actual);
+
+        check(is_same_hash(actual, expected), "hash_with_sha_256 doesn't match scalar backend", size);
+    }
+}
+
+// Fixed-size hashing lays padding out at compile time, so each size is a
+// separate instantiation, all of them are checked against one-shot hashing
+template <size_t... sizes>
+void test_fixed_sizes(std::index_sequence<sizes...>) {
+    std::vector<unsigned char> sample = make_sample(MAX_SAMPLE_SIZE);
+
+    ([&] {
+        uint32_t expected[HASH_SIZE], actual[HASH_SIZE];
+
+        hash_with_sha_256(sample.data(), sizes, expected);
+        hash_with_sha_256<sizes>(sample.data(), actual);
+
+        check(is_same_hash(actual, expected), "fixed-size hash doesn't match one-shot hash", sizes);
+
+        // Same, through the object overload (empty array still takes a byte):
+        if constexpr (sizes > 0) {
+            std::array<unsigned char, sizes> object;
+            std::copy_n(sample.begin(), sizes, object.begin());
+            hash_with_sha_256(object, actual);
+
+            check(is_same_hash(actual, expected), "object hash doesn't match one-shot hash", sizes);
+        }
+    }(), ...);
+}
+
+// Compile-time hashing is what embedded hashes (like genesis) are checked with
+constexpr bool is_abc_hashed_at_compile_time() {
+    uint32_t hash[HASH_SIZE] = {};
+    hash_with_sha_256(std::array<unsigned char, 3> { 'a', 'b', 'c' }, hash);
+
+    const uint32_t expected[HASH_SIZE] = {
+        0xba7816bf, 0x8f01cfea, 0x414140de, 0x5dae2223, 0xb00361a3, 0x96177a9c, 0xb410ff61, 0xf20015ad
+    };
+
+    for (size_t i = 0; i < HASH_SIZE; ++ i)
+        if (hash[i] != expected[i])
+            return false;
+
+    return true;
+}
+
+static_assert(is_abc_hashed_at_compile_time(), "Compile-time SHA-256 doesn't match known answer");
+
+// Midstate of the first block, finished for each size that has it
+template <size_t... sizes>
+void test_midstates(std::index_sequence<sizes...>) {
+    std::vector<unsigned char> sample = make_sample(MAX_SAMPLE_SIZE);
+
+    ([&] {
+        constexpr size_t size = SHA_256_BLOCK_SIZE + sizes;
+        uint32_t expected[HASH_SIZE], actual[HASH_SIZE];
+
+        hash_with_sha_256(sample.data(), size, expected);
+
+        start_sha_256<1>(sample.data(), actual);
+        finish_sha_256<size, 1>(sample.data(), actual);
+
+        check(is_same_hash(actual, expected), "hash from midstate doesn't match one-shot hash", size);
+    }(), ...);
+}
+
+// Miner only changes the suffix of a block, and finishes hashes from the
+// midstate of the prefix, which has to come up with the same hash
+void test_block_midstate() {
+    block candidate {
+        .version = BLOCK_VERSION,
+        .previous_hash = { 1, 2, 3, 4, 5, 6, 7, 8 },
+        .data = {},
+        .reserved = {},
+        .pow_signature = 0,
+        .pow_extra_signature = 0,
+        .timestamp = 1792108800000,
+        .proof_order = PROOF_ORDER,
+        .reserved_suffix = {}
+    };
+    candidate.data.act({ .vote = 'a' });
+
+    hash256_t midstate = candidate.calculate_midstate();
+    for (uint32_t signature = 0; signature < 1000; ++ signature) {
+        candidate.pow_signature = signature * 2654435761u;
+        candidate.pow_extra_signature = signature / 7;
+
+        check(candidate.calculate_hash(midstate) == candidate.calculate_hash(),
+              "block hash from midstate doesn't match full hash", sizeof(block));
+    }
+}
+
+// Whatever the message is split into, streaming comes up with the same
+// hash as one-shot hashing: every size, cut at every point, and fed in
+// chunks of every size too
+void test_streaming() {
+    std::vector<unsigned char> sample = make_sample(MAX_SAMPLE_SIZE);
+
+    for (size_t size = 0; size <= MAX_SAMPLE_SIZE; ++ size) {
+        uint32_t expected[HASH_SIZE];
+        hash_with_sha_256(sample.data(), size, expected);
+
+        for (size_t cut = 0; cut <= size; ++ cut) {
+            sha_256_context context;
+            init_sha_256(&context);
+
+            update_sha_256(&context, sample.data(), cut);
+            update_sha_256(&context, sample.data() + cut, size - cut);
+
+            uint32_t actual[HASH_SIZE];
+            final_sha_256(&context, actual);
+
+            check(is_same_hash(actual, expected), "streaming hash of two chunks doesn't match one-shot hash", size);
+        }
+
+        for (size_t chunk = 1; chunk <= size; ++ chunk) {
+            sha_256_context context;
+            init_sha_256(&context);
+
+            for (size_t offset = 0; offset < size; offset += chunk)
+                update_sha_256(&context, sample.data() + offset, std::min(chunk, size - offset));
+
+            uint32_t actual[HASH_SIZE];
+            final_sha_256(&context, actual);
+
+            check(is_same_hash(actual, expected), "streaming hash of equal chunks doesn't match one-shot hash", size);
+        }
+    }
+
+    for (const known_answer &answer: KNOWN_ANSWERS) {
+        sha_256_context context;
+        init_sha_256(&context);
+
+        for (char byte: answer.message)
+            update_sha_256(&context, &byte, 1);
+
+        uint32_t hash[HASH_SIZE];
+        final_sha_256(&context, hash);
+
+        check(is_same_hash(hash, answer.hash), "byte by byte streaming hash doesn't match known answer",
+              answer.message.size());
+    }
+}
+
+void test_file_hashing() {
+    for (const known_answer &answer: KNOWN_ANSWERS) {
+        char path[] = "/tmp/sha256-test-XXXXXX";
+
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            perror("mkstemp");
+            ++ failures;
+            return;
+        }
+
+        bool is_written = write(fd, answer.message.data(), answer.message.size()) == (ssize_t) answer.message.size();
+        close(fd);
+
+        uint32_t hash[HASH_SIZE];
+        bool is_hashed = is_written && hash_file_with_sha_256(path, hash);
+        unlink(path);
+
+        check(is_hashed && is_same_hash(hash, answer.hash), "file hash doesn't match known answer",
+              answer.message.size());
+    }
+}
+
+// Every lane of every kernel has to come up with the same hash as one-shot
+// hashing does. Messages differ between lanes, so that lanes mixing up is seen.
+void test_batch_kernels() {
+    for (const sha_256_batch_kernel &kernel: get_sha_256_batch_kernels()) {
+        for (size_t size = 0; size <= MAX_SAMPLE_SIZE; ++ size) {
+            std::vector<std::vector<unsigned char>> messages;
+            const void* data_ptrs[SHA_256_MAX_LANES];
+
+            for (size_t lane = 0; lane < kernel.lanes; ++ lane) {
+                messages.push_back(make_sample(size));
+                if (size > 0)
+                    messages.back()[0] ^= (unsigned char) lane;
+
+                data_ptrs[lane] = messages.back().data();
+            }
+
+            uint32_t hashes[SHA_256_MAX_LANES][HASH_SIZE];
+            kernel.hash(data_ptrs, size, hashes);
+
+            for (size_t lane = 0; lane < kernel.lanes; ++ lane) {
+                uint32_t expected[HASH_SIZE];
+                hash_with_sha_256(messages[lane].data(), size, expected);
+
+                std::string what = std::string(kernel.name) + " batch kernel doesn't match one-shot hash";
+                check(is_same_hash(hashes[lane], expected), what.c_str(), size);
+            }
+        }
+
+        for (const known_answer &answer: KNOWN_ANSWERS) {
+            const void* data_ptrs[SHA_256_MAX_LANES];
+            for (size_t lane = 0; lane < kernel.lanes; ++ lane)
+                data_ptrs[lane] = answer.message.data();
+
+            uint32_t hashes[SHA_256_MAX_LANES][HASH_SIZE];
+            kernel.hash(data_ptrs, answer.message.size(), hashes);
+
+            std::string what = std::string(kernel.name) + " batch kernel doesn't match known answer";
+            check(is_same_hash(hashes[kernel.lanes - 1], answer.hash), what.c_str(), answer.message.size());
+        }
+    }
+
+    // Counts that leave a partial pass, for both ways of padding:
+    for (size_t size: { size_t(80), SHA_256_FIXED_BATCH_SIZE }) {
+        for (size_t count = 1; count <= 2 * SHA_256_MAX_LANES + 1; ++ count) {
+            std::vector<std::vector<unsigned char>> messages;
+            std::vector<const void*> data_ptrs;
+
+            for (size_t i = 0; i < count; ++ i) {
+                messages.push_back(make_sample(size));
+                messages.back()[0] ^= (unsigned char) i;
+            }
+
+            for (const auto &message: messages)
+                data_ptrs.push_back(message.data());
+
+            std::vector<uint32_t[HASH_SIZE]> hashes(count);
+            hash_with_sha_256_batch(data_ptrs.data(), size, count, hashes.data());
+
+            for (size_t i = 0; i < count; ++ i) {
+                uint32_t expected[HASH_SIZE];
+                hash_with_sha_256(messages[i].data(), size, expected);
+
+                check(is_same_hash(hashes[i], expected), "hash_with_sha_256_batch with a partial pass", size);
+            }
+        }
+    }
+}
+
+int main() {
+    test_known_answers();
+    test_compressors();
+    test_fixed_sizes(std::make_index_sequence<MAX_SAMPLE_SIZE + 1>());
+    test_midstates(std::make_index_sequence<MAX_SAMPLE_SIZE - SHA_256_BLOCK_SIZE + 1>());
+    test_block_midstate();
+    test_streaming();
+    test_file_hashing();
+    test_batch_kernels();
+
+    if (failures > 0)
+        return 1;
+
+    printf("OK: all SHA-256 checks passed\n");
+}
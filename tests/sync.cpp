@@ -0,0 +1,350 @@
+#include "simulation.h"
+#include "blockchain.h"
+#include "block-store.h"
+#include "miner.h"
+
+#include <filesystem>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+// Sync is looked at from both of its ends. Node that misses blocks sends a
+// locator of its best chain: ten latest blocks, then exponentially sparser
+// ones, down to genesis. Node that gets a locator sends its best chain up
+// from the first block in it that's on that chain, MAX_SYNC_BLOCKS at most.
+// Then two nodes do it all themselves: the one that's behind catches up,
+// with a request per batch, and no orphans left over.
+//
+// Nodes start from chains in their stores, which they load without checks,
+// so only blocks that are actually synced need to be signed.
+
+namespace {
+
+bool check(bool condition, const char *what) {
+    if (!condition)
+        fprintf(stderr, "FAIL: %s\n", what);
+
+    return condition;
+}
+
+// Blocks come four target intervals apart, so that every retarget lowers
+// difficulty as much as it can, until it's the lowest one
+constexpr uint64_t BLOCK_SPACING = 4 * TARGET_BLOCK_INTERVAL.count();
+
+uint32_t proof_order_at(uint64_t height) {
+    int64_t order = int64_t(GENESIS_BLOCK.proof_order) - MAX_RETARGET_STEP * int64_t(height / RETARGET_WINDOW);
+    return std::max<int64_t>(order, MIN_PROOF_ORDER);
+}
+
+block make_child(const block &parent, uint64_t height, char vote) {
+    block child {
+        .version = BLOCK_VERSION,
+        .previous_hash = parent.calculate_hash(),
+        .data = {},
+        .reserved = {},
+        .pow_signature = 0,
+        .pow_extra_signature = 0,
+        .timestamp = parent.timestamp + BLOCK_SPACING,
+        .proof_order = proof_order_at(height),
+        .reserved_suffix = {}
+    };
+    child.data.act({ .vote = vote });
+
+    return child;
+}
+
+block sign(miner &signer, const block &candidate) {
+    signer.start(candidate);
+
+    std::optional<block> signed_block;
+    while (!(signed_block = signer.poll())) {
+        pollfd completion { .fd = signer.completion_fd(), .events = POLLIN, .revents = 0 };
+        poll(&completion, 1, 100);
+    }
+
+    return *signed_block;
+}
+
+// Genesis, then `count` blocks above it, signed only if `signer` is given
+void grow_chain(std::vector<block> &chain, size_t count, char vote, miner *signer = nullptr) {
+    for (size_t i = 0; i < count; ++ i) {
+        block child = make_child(chain.back(), chain.size(), vote);
+        chain.push_back(signer ? sign(*signer, child) : child);
+    }
+}
+
+bool write_store(const char *directory, const std::vector<block> &blocks) {
+    block_store store;
+    if (!store.open(directory))
+        return false;
+
+    for (const block &stored: blocks)
+        if (!store.append(stored, stored.calculate_hash()))
+            return false;
+
+    return true;
+}
+
+// Test's own end of the network, it plays a peer by hand
+class observer {
+public:
+    explicit observer(simulation &&net): net_(std::move(net)), sequence_number_(0) {}
+
+    // Nodes constructed after observer are learned about from their DISCOVERs
+    std::optional<address> discover_node() {
+        transaction discover;
+        address node_address;
+        if (!net_.receive(discover, &node_address) || discover.type != transaction_type::DISCOVER)
+            return std::nullopt;
+
+        return node_address;
+    }
+
+    void send(transaction message, address target) {
+        message.sequence_number = sequence_number_ ++;
+        net_.send(buffer(&message, get_transaction_size(message)), target);
+    }
+
+    // Everything of the given type that's received within a short while
+    std::vector<transaction> receive_all(transaction_type type) {
+        usleep(300000);
+
+        std::vector<transaction> received;
+
+        transaction incoming;
+        address sender;
+        while (net_.receive(incoming, &sender))
+            if (incoming.type == type)
+                received.push_back(incoming);
+
+        return received;
+    }
+
+    // Asks node for its best tip until it's the expected one
+    bool wait_for_tip(address node_address, const block &expected) {
+        hash256_t expected_hash = expected.calculate_hash();
+
+        for (int attempt = 0; attempt < 100; ++ attempt) {
+            sequence_number_ = 0; // DISCOVER starts counting over
+            send({ .channel = 0, .type = transaction_type::DISCOVER, .signed_block = {} }, node_address);
+
+            for (const transaction &tip: receive_all(transaction_type::SYNC))
+                if (tip.signed_block.calculate_hash() == expected_hash)
+                    return true;
+        }
+
+        return false;
+    }
+
+private:
+    simulation net_;
+    uint32_t sequence_number_;
+};
+
+// Node's best chain is `chain`, with a shorter branch off it
+struct locator_setup {
+    std::vector<block> chain;
+    std::vector<block> branch;
+    std::map<hash256_t, uint64_t> heights; // Of blocks on the best chain
+};
+
+// Node is made to miss a block, so it asks observer for blocks with its locator
+bool test_locator(observer &peer, address node_address, const locator_setup &setup) {
+    miner signer(1);
+
+    // Orphan doesn't need a valid parent, just valid PoW
+    block orphan = make_child(setup.chain.back(), 0, 'o');
+    orphan.previous_hash = hash256_t { 1 };
+    orphan.proof_order = MIN_PROOF_ORDER;
+    orphan = sign(signer, orphan);
+
+    peer.send({ .channel = 0, .type = transaction_type::NOTIFY_SIGNED, .signed_block = orphan }, node_address);
+
+    std::vector<transaction> requests = peer.receive_all(transaction_type::GET_BLOCKS);
+    if (!check(requests.size() == 1, "node didn't request missing blocks once"))
+        return false;
+
+    const block_locator &locator = requests[0].locator;
+    bool ok = check(locator.count >= 2 && locator.count <= MAX_LOCATOR_HASHES, "locator has wrong size");
+
+    std::vector<uint64_t> heights;
+    for (uint32_t i = 0; i < locator.count; ++ i) {
+        auto found = setup.heights.find(locator.hashes[i]);
+        if (!check(found != setup.heights.end(), "locator has a block that isn't on the best chain"))
+            return false;
+
+        heights.push_back(found->second);
+    }
+
+    ok &= check(heights.front() == setup.chain.size() - 1, "locator doesn't start at the best tip");
+    ok &= check(heights.back() == 0, "locator doesn't end with genesis");
+
+    // Ten latest go one by one, every next step is twice the previous one
+    uint64_t step = 1;
+    for (size_t i = 1; i + 1 < heights.size(); ++ i) {
+        ok &= check(heights[i - 1] - heights[i] == step, "locator isn't exponentially sparser");
+        if (i >= 10)
+            step *= 2;
+    }
+
+    ok &= check(heights[heights.size() - 2] <= step, "locator stops before it gets sparse enough");
+    return ok;
+}
+
+// Requests blocks above a locator, and checks that what's received is the
+// best chain right above `fork`
+bool check_fork(observer &peer, address node_address, const locator_setup &setup,
+                const std::vector<hash256_t> &hashes, uint64_t fork, const char *what) {
+
+    transaction request { .channel = 0, .type = transaction_type::GET_BLOCKS, .locator = {} };
+    for (const hash256_t &hash: hashes)
+        request.locator.hashes[request.locator.count ++] = hash;
+
+    peer.send(request, node_address);
+    std::vector<transaction> sent = peer.receive_all(transaction_type::SYNC);
+
+    uint64_t last = std::min<uint64_t>(fork + MAX_SYNC_BLOCKS, setup.chain.size() - 1);
+
+    bool is_expected = sent.size() == last - fork;
+    for (size_t i = 0; is_expected && i < sent.size(); ++ i)
+        is_expected = memcmp(&sent[i].signed_block, &setup.chain[fork + 1 + i], sizeof(block)) == 0;
+
+    return check(is_expected, what);
+}
+
+bool test_fork_point(observer &peer, address node_address, const locator_setup &setup) {
+    auto hash_at = [&](uint64_t height) { return setup.chain[height].calculate_hash(); };
+
+    hash256_t unknown = { 2 };
+    hash256_t branch_tip = setup.branch.back().calculate_hash();
+    uint64_t tip = setup.chain.size() - 1;
+
+    bool ok = check_fork(peer, node_address, setup, { hash_at(tip) }, tip, "blocks sent above the best tip");
+    ok &= check_fork(peer, node_address, setup, { hash_at(700), hash_at(300) }, 700, "fork isn't the first known block");
+    ok &= check_fork(peer, node_address, setup, { unknown, hash_at(tip - 10), GENESIS_HASH }, tip - 10,
+                     "unknown block isn't skipped, or batch doesn't stop at the tip");
+    ok &= check_fork(peer, node_address, setup, { branch_tip, hash_at(490), GENESIS_HASH }, 490,
+                     "block that isn't on the best chain is taken for fork");
+    ok &= check_fork(peer, node_address, setup, { unknown }, 0, "nothing in common doesn't fork at genesis");
+
+    return ok;
+}
+
+bool test_locator_and_fork() {
+    locator_setup setup { .chain = { GENESIS_BLOCK }, .branch = {}, .heights = {} };
+
+    grow_chain(setup.chain, 1000, 'c');
+    for (uint64_t height = 0; height < setup.chain.size(); ++ height)
+        setup.heights[setup.chain[height].calculate_hash()] = height;
+
+    // Branch goes off the middle of the chain, so it has less work
+    setup.branch = { setup.chain[500] };
+    grow_chain(setup.branch, 5, 'b');
+    setup.branch.erase(setup.branch.begin());
+
+    std::vector<block> stored = setup.chain;
+    stored.insert(stored.end(), setup.branch.begin(), setup.branch.end());
+
+    if (!check(write_store("locator", stored), "node's store wasn't written"))
+        return false;
+
+    simulation_builder builder;
+    observer peer(builder.produce_node());
+
+    blockchain<simulation> node(-1, 0, builder.produce_node(), 1, "locator");
+
+    std::optional<address> node_address = peer.discover_node();
+    if (!check(node_address.has_value(), "node didn't broadcast DISCOVER"))
+        return false;
+
+    std::thread running([&node] { node.run(); });
+
+    bool ok = test_locator(peer, *node_address, setup);
+    ok &= test_fork_point(peer, *node_address, setup);
+
+    node.stop();
+    running.join();
+
+    return ok;
+}
+
+// Enough batches to need several requests, each of them full
+constexpr size_t CATCH_UP_BATCHES = 3;
+
+bool test_catch_up() {
+    // Both nodes have blocks up to the lowest difficulty, only the rest is signed
+    std::vector<block> common = { GENESIS_BLOCK };
+    grow_chain(common, (GENESIS_BLOCK.proof_order - MIN_PROOF_ORDER) / MAX_RETARGET_STEP * RETARGET_WINDOW - 1, 'c');
+
+    std::vector<block> ahead = common;
+
+    miner signer(1);
+    grow_chain(ahead, CATCH_UP_BATCHES * MAX_SYNC_BLOCKS, 'a', &signer);
+
+    bool ok = check(write_store("behind", common), "store of node that's behind wasn't written");
+    ok &= check(write_store("ahead", ahead), "store of node that's ahead wasn't written");
+
+    if (!ok)
+        return false;
+
+    // Node that's behind hears DISCOVER of the one that's ahead, and requests its tip's ancestors
+    simulation_builder builder;
+    observer peer(builder.produce_node());
+
+    blockchain<simulation> node_ahead(-1, 0, builder.produce_node(), 1, "ahead");
+    blockchain<simulation> node_behind(-1, 0, builder.produce_node(), 1, "behind");
+
+    std::optional<address> ahead_address = peer.discover_node(), behind_address = peer.discover_node();
+    if (!check(ahead_address && behind_address, "nodes didn't broadcast DISCOVER"))
+        return false;
+
+    std::thread running_ahead([&node_ahead] { node_ahead.run(); });
+    std::thread running_behind([&node_behind] { node_behind.run(); });
+
+    ok &= check(peer.wait_for_tip(*behind_address, ahead.back()), "node didn't catch up");
+
+    // Last batch is full, so there's one more request after it, that brings nothing
+    sleep(1);
+
+    node_behind.stop();
+    node_ahead.stop();
+
+    running_behind.join();
+    running_ahead.join();
+
+    ok &= check(node_behind.get_sync_requests() == CATCH_UP_BATCHES + 1, "blocks were requested more than once per batch");
+    ok &= check(node_behind.get_orphan_count() == 0, "orphans were left after catching up");
+    ok &= check(node_behind.get_vote_counts()['a'] == CATCH_UP_BATCHES * MAX_SYNC_BLOCKS, "not every block was linked");
+
+    return ok;
+}
+
+} // end anonymous namespace
+
+
+int main() {
+    // Nodes watch their working directory for the act file, they shouldn't find one
+    char directory[] = "/tmp/sync-XXXXXX";
+    if (!mkdtemp(directory) || chdir(directory) != 0) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    bool ok = test_locator_and_fork();
+    ok &= test_catch_up();
+
+    std::filesystem::remove_all(directory);
+
+    if (!ok)
+        return 1;
+
+    printf("OK: node that's behind catches up, a batch per request\n");
+    return 0;
+}